@@ -1,17 +1,19 @@
 #pragma once
+#include <map>
+#include <tuple>
 #include <vector>
-#include <queue>
 #include "tokenize.h"
+#include "machine.h"
+#include "encode.h"
+#include "peephole.h"
 #include "register.h"
 
-void initAST();
-
-enum class LineType {
+enum class LineType : unsigned char {
 	Return, Expression, VariableDeclaration, If, Block, For, While, DoWhile, Break, Continue
 };
-enum class ExpressionType {
+enum class ExpressionType : unsigned char {
 	BinaryOperator, ConstantInt, VariableRef, UnaryOperator, Ternary, FunctionCall,
-	ConstantChar, ConstantShort, ConstantLong, ConstantString, MemberAccess
+	ConstantChar, ConstantShort, ConstantLong, ConstantString, MemberAccess, PointerMemberAccess
 };
 
 class DataType {
@@ -66,23 +68,41 @@ inline const DataType DataType::LONG = DataType(4, 0, false, _bytes(i64));
 inline const DataType DataType::LONG_PTR = DataType(4, 1, false, _bytes(i64));
 
 struct assembly {
-	std::vector<std::string> lines;
-
-	assembly() {
+	std::vector<MachineInstr> code;
+	output_buffer* out = nullptr; // assembly text goes to out, machine code to object
+	object_file* object = nullptr;
+	peephole_optimizer* peephole = nullptr; // rewrites each function before it's written, if set
+	bool avx2 = false; // vectorized loops use 32 byte ymm registers instead of 16 byte xmm ones
+	bool system_v = false; // calls and parameters follow the System V ABI rather than Windows x64
+
+	assembly(output_buffer& out)
+		: out(&out) {
 	}
 
-	assembly(std::initializer_list<std::string> l) {
-		for (std::string s : l) add(s);
+	assembly(object_file& object)
+		: object(&object) {
 	}
 
-	assembly& add(std::string s) {
-		lines.push_back(s);
+	assembly& add(const MachineInstr& in) {
+		code.push_back(in);
 		return *this;
 	}
 
-	assembly& add(std::string instruction, size s, reg dst, bool index = false) {
-		lines.push_back("\t" + instruction + _suffix(s) + (index ? " (%" + _register(dst, i64) + ")" : " %" + _register(dst, s)));
-		return *this;
+	assembly& add(Opcode op, size s, MachineOperand src, MachineOperand dst) {
+		return add(machine_instr(op, s, src, dst));
+	}
+
+	assembly& add(Opcode op, size s, MachineOperand dst) {
+		return add(machine_instr(op, s, MachineOperand(), dst));
+	}
+
+	// instructions without a size: push, pop, jumps, calls, labels
+	assembly& add(Opcode op, MachineOperand dst = MachineOperand()) {
+		return add(machine_instr(op, i64, MachineOperand(), dst));
+	}
+
+	assembly& add(Opcode op, size s, reg dst, bool index = false) {
+		return add(op, s, index ? memory_operand(dst) : register_operand(dst, s));
 	}
 
 	assembly& convert(size s1, size s2, reg r) {
@@ -120,161 +140,23 @@ struct assembly {
 		return *this;
 	}
 
-	assembly& add(std::string instruction, size s, reg src, reg dst, bool src_index = false, bool dst_index = false) {
-		lines.push_back("\t" + instruction + _suffix(s) +
-			(src_index ? " (%" + _register(src, i64) + ")" : " %" + _register(src, s)) +
-			(dst_index ? ", (%" + _register(dst, i64) + ")" : ", %" + _register(dst, s)));
-		return *this;
-	}
-
-	assembly& add(std::string instruction, size s, int src, reg dst) {
-		lines.push_back("\t" + instruction + _suffix(s) + " $" + std::to_string(src) + ", %" + _register(dst, s));
-		return *this;
-	}
-
-	void add(const assembly& other) {
-		for (std::string l : other.lines) {
-			add(l);
-		}
-	}
-
-	std::string str() {
-		std::string s;
-		for (std::string l : lines) {
-			s += l + "\n";
-		}
-		return s;
-	}
-};
-
-struct ASTNode {
-	virtual void generateAssembly(assembly& ass) = 0;
-};
-
-struct BlockItem : ASTNode {
-	LineType type;
-	BlockItem(LineType type) : type(type) {
+	assembly& add(Opcode op, size s, reg src, reg dst, bool src_index = false, bool dst_index = false) {
+		return add(op, s, src_index ? memory_operand(src) : register_operand(src, s), dst_index ? memory_operand(dst) : register_operand(dst, s));
 	}
-};
 
-struct LineOfCode : BlockItem {
-	LineOfCode(LineType type) : BlockItem(type) {
+	assembly& add(Opcode op, size s, int src, reg dst) {
+		return add(op, s, immediate_operand(src), register_operand(dst, s));
 	}
-};
 
-struct Expression : ASTNode {
-	DataType return_type;
-	ExpressionType type;
-	Expression(ExpressionType type, DataType return_type) : type(type), return_type(return_type) {
+	// formats or encodes the code generated so far and drops it
+	void flush() {
+		if (peephole) peephole->run(code);
+		if (out) format_instructions(code, *out);
+		else encode_instructions(code, *object);
+		code.clear();
 	}
 };
 
-struct ExpressionLine : LineOfCode {
-	Expression* exp;
-	ExpressionLine(Expression* exp) : LineOfCode(LineType::Expression), exp(exp) {
-	}
-	virtual void generateAssembly(assembly& ass) override;
-};
-
-struct CodeBlock : LineOfCode {
-	std::vector<BlockItem*> lines;
-	CodeBlock() : LineOfCode(LineType::Block) {}
-	virtual void generateAssembly(assembly& ass) override;
-};
-
-struct VariableDeclarationLine : BlockItem {
-	DataType var_type;
-	Expression* init_exp;
-	std::string name;
-	VariableDeclarationLine(Expression* init_exp, DataType var_type, std::string name) : BlockItem(LineType::VariableDeclaration),
-		init_exp(init_exp), var_type(var_type), name(name) {
-
-	}
-	virtual void generateAssembly(assembly& ass) override;
-};
-
-struct Function : ASTNode {
-	std::string name;
-	std::vector<std::pair<std::string, DataType>> params;
-	DataType return_type;
-	CodeBlock* lines;
-	virtual void generateAssembly(assembly& ass) override;
-};
-
-struct Struct : ASTNode {
-	int id;
-	std::string name;
-	std::vector<VariableDeclarationLine*> fields;
-	std::vector<Function*> functions;
-	virtual void generateAssembly(assembly& ass) override;
-};
-
-struct FunctionCall : Expression {
-	Expression* loc;
-	std::vector<Expression*> params;
-	FunctionCall(Expression* loc, DataType return_type) : Expression(ExpressionType::FunctionCall, return_type), loc(loc) {}
-	virtual void generateAssembly(assembly& ass) override;
-};
-
-struct Application : ASTNode {
-	std::vector<ASTNode*> nodes;
-	virtual void generateAssembly(assembly& ass) override;
-};
-
-struct Return : LineOfCode {
-	Return(Expression* expr) : LineOfCode(LineType::Return), expr(expr) { };
-	Expression* expr;
-	virtual void generateAssembly(assembly& ass) override;
-};
-
-struct IfStatement : LineOfCode {
-	Expression* condition;
-	LineOfCode* if_cond, * else_cond;
-	IfStatement(Expression* condition, LineOfCode* if_cond, LineOfCode* else_cond) : LineOfCode(LineType::If),
-		condition(condition), if_cond(if_cond), else_cond(else_cond) { };
-
-	virtual void generateAssembly(assembly& ass) override;
-};
-
-struct ForLoop : LineOfCode {
-	BlockItem* initial;
-	Expression* condition;
-	Expression* post;
-	LineOfCode* inner;
-	ForLoop(BlockItem* initial, Expression* condition, Expression* post, LineOfCode* inner) : LineOfCode(LineType::For),
-		initial(initial), condition(condition), post(post), inner(inner) { };
-
-	virtual void generateAssembly(assembly& ass) override;
-};
-
-struct Break : LineOfCode {
-	Break() : LineOfCode(LineType::Break) {}
-	virtual void generateAssembly(assembly& ass) override;
-};
-
-struct Continue : LineOfCode {
-	Continue() : LineOfCode(LineType::Continue) {}
-	virtual void generateAssembly(assembly& ass) override;
-};
-
-struct WhileLoop : LineOfCode {
-	Expression* condition;
-	LineOfCode* inner;
-	WhileLoop(Expression* condition, LineOfCode* inner) : LineOfCode(LineType::While),
-		condition(condition), inner(inner) { };
-
-	virtual void generateAssembly(assembly& ass) override;
-};
-
-struct DoWhileLoop : LineOfCode {
-	Expression* condition;
-	LineOfCode* inner;
-	DoWhileLoop(Expression* condition, LineOfCode* inner) : LineOfCode(LineType::DoWhile),
-		condition(condition), inner(inner) { };
-
-	virtual void generateAssembly(assembly& ass) override;
-};
-
 enum binary_operator {
 	add, subtract, multiply, divide, mod,
 	logical_and, logical_or,
@@ -287,13 +169,6 @@ enum binary_operator {
 	and_assign, or_assign, xor_assign
 };
 
-struct BinaryOperator : Expression {
-	BinaryOperator(binary_operator op, Expression* left, Expression* right, DataType return_type) : Expression(ExpressionType::BinaryOperator, return_type), op(op), left(left), right(right) { };
-	Expression* left, * right;
-	binary_operator op;
-	virtual void generateAssembly(assembly& ass) override;
-};
-
 enum unary_operator {
 	negation, plus, bitwise_complement, logical_negation,
 	prefix_increment, prefix_decrement,
@@ -301,72 +176,93 @@ enum unary_operator {
 	address, dereference
 };
 
-struct UnaryOperator : Expression {
-	UnaryOperator(unary_operator op, Expression* left, DataType return_type) : Expression(ExpressionType::UnaryOperator, return_type), op(op), left(left) { };
-	Expression* left;
-	unary_operator op;
-	virtual void generateAssembly(assembly& ass) override;
-};
-
-struct TernaryExpression : Expression {
-	TernaryExpression(Expression* condition, Expression* if_cond, Expression* else_cond, DataType return_type) :
-		Expression(ExpressionType::Ternary, return_type), condition(condition), if_cond(if_cond), else_cond(else_cond) { };
-	Expression* condition;
-	Expression* if_cond;
-	Expression* else_cond;
-	virtual void generateAssembly(assembly& ass) override;
+// the tree is stored flat: each kind of node lives in its own array in the Application
+// and nodes refer to each other by their index in it. the arrays own every record, so
+// nothing is allocated per node and the whole tree goes away with the Application
+typedef unsigned int node_index;
+const node_index NO_NODE = ~0u;
+
+// types are interned in the Application, so a node holds a small index instead of a whole DataType
+typedef unsigned short type_index;
+
+// what op, a and b hold depends on the type:
+//   BinaryOperator        op, a = left, b = right
+//   UnaryOperator         op, a = operand
+//   Ternary               a = condition, b = first of the if and else expressions in children
+//   FunctionCall          op = argument count, a = called expression, b = first argument in children
+//   ConstantChar/Short/Int  a = value
+//   ConstantLong          a = low half, b = high half
+//   ConstantString        a = index in strings
+//   VariableRef           a = name
+//   (Pointer)MemberAccess a = left, b = member name
+struct Expression {
+	ExpressionType type;
+	unsigned char op;
+	type_index return_type;
+	node_index a, b;
+};
+
+// what a, b and c hold depends on the type:
+//   Return, Expression    a = expression or NO_NODE
+//   VariableDeclaration   a = initial expression or NO_NODE, b = name, c = declared type
+//   If                    a = condition, b = if line, c = else line or NO_NODE
+//   Block                 a = first line in children, b = line count
+//   For                   a = initial line or NO_NODE, b = condition, c = first of the post expression
+//                         (or NO_NODE) and the inner line in children
+//   While, DoWhile        a = condition, b = inner line
+struct Line {
+	LineType type;
+	node_index a, b, c;
 };
 
-struct VariableRef : Expression {
-	VariableRef(std::string name) : Expression(ExpressionType::VariableRef, DataType::INT),
-		name(name) {
-	};
-	std::string name;
-	virtual void generateAssembly(assembly& ass) override;
+struct Function {
+	symbol name;
+	std::vector<std::pair<symbol, DataType>> params;
+	DataType return_type;
+	node_index lines = NO_NODE; // the body block, NO_NODE for a declaration
 };
 
-struct MemberAccess : Expression {
-	MemberAccess(Expression* left, std::string right, DataType return_type) : Expression(ExpressionType::MemberAccess, return_type), left(left), right(right) { };
-	Expression* left;
-	std::string right;
-	virtual void generateAssembly(assembly& ass) override;
+struct Struct {
+	int id;
+	symbol name;
+	std::vector<node_index> fields; // VariableDeclaration lines
+	std::vector<node_index> functions;
 };
 
-struct PointerMemberAccess : Expression {
-	PointerMemberAccess(Expression* left, std::string right, DataType return_type) : Expression(ExpressionType::MemberAccess, return_type), left(left), right(right) { };
-	Expression* left;
-	std::string right;
-	virtual void generateAssembly(assembly& ass) override;
+enum class DeclarationType : unsigned char {
+	Function, Struct
 };
 
-struct ConstantChar : Expression {
-	ConstantChar(char val) : Expression(ExpressionType::ConstantChar, DataType::CHAR), val(val) { };
-	char val;
-	virtual void generateAssembly(assembly& ass) override;
+struct Declaration {
+	DeclarationType type;
+	node_index index;
 };
 
-struct ConstantShort : Expression {
-	ConstantShort(short val) : Expression(ExpressionType::ConstantShort, DataType::SHORT), val(val) { };
-	short val;
-	virtual void generateAssembly(assembly& ass) override;
-};
+struct bytecode_program;
+struct ir_function;
 
-struct ConstantInt : Expression {
-	ConstantInt(int val) : Expression(ExpressionType::ConstantInt, DataType::INT), val(val) { };
-	int val;
-	virtual void generateAssembly(assembly& ass) override;
-};
+struct Application {
+	std::vector<Expression> expressions;
+	std::vector<Line> lines;
+	std::vector<node_index> children; // call arguments, block lines and the pairs of ?: and for, each list contiguous
+	std::vector<DataType> types; // each distinct type once
+	std::vector<std::string> strings;
+	std::vector<Function> functions;
+	std::vector<Struct> structs;
+	std::vector<Declaration> declarations; // top level, in source order
 
-struct ConstantLong : Expression {
-	ConstantLong(long long val) : Expression(ExpressionType::ConstantLong, DataType::LONG), val(val) { };
-	long long val;
-	virtual void generateAssembly(assembly& ass) override;
-};
+	// the index of t in types, added the first time it's used
+	type_index type_id(const DataType& t);
+	const DataType& expression_type(node_index e) const {
+		return types[expressions[e].return_type];
+	}
+	void fold_constants(); // replaces constant subtrees and constant locals with their values
+	void generateAssembly(assembly& ass);
+	void generateBytecode(bytecode_program& program);
+	void generateIR(std::vector<ir_function>& functions); // one per function with a body
 
-struct ConstantString : Expression {
-	ConstantString(std::string val) : Expression(ExpressionType::ConstantString, DataType::CHAR_PTR), val(val) { };
-	std::string val;
-	virtual void generateAssembly(assembly& ass) override;
+private:
+	std::map<std::tuple<int, int, bool, int>, type_index> type_ids;
 };
 
-Application* compile_application(std::queue<token>& tokens);
\ No newline at end of file
+Application compile_application(token_stream& tokens);
\ No newline at end of file
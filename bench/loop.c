@@ -0,0 +1,9 @@
+long main() {
+	long total = 0l;
+	for (long i = 0l; i < 20000l; i++) {
+		for (long j = 0l; j < 1000l; j++) {
+			total = total + i * j % 7l;
+		}
+	}
+	return total % 256l;
+}
@@ -0,0 +1,11 @@
+long main() {
+	long total = 0l;
+	long x = 1l;
+	for (long i = 0l; i < 20000l; i++) {
+		for (long j = 0l; j < 10000l; j++) {
+			total = total + (i ^ j) + x;
+			x = x + j & 1023l;
+		}
+	}
+	return total % 256l;
+}
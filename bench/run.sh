@@ -0,0 +1,36 @@
+#!/bin/bash
+# times each program here in the bytecode VM, in the JIT and as a native executable linked
+# with gcc from the compiler's object file, best of a few runs, and checks that all three
+# return the same exit code. needs Linux on x86-64
+#   bench/run.sh path/to/compiler [runs]
+
+compiler=$(realpath "${1:?usage: bench/run.sh compiler [runs]}")
+runs=${2:-5}
+cd "$(dirname "$0")"
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+TIMEFORMAT=%R
+
+# the best wall time in seconds of running a command, and its exit code
+best() {
+	local fastest= t
+	for ((r = 0; r < runs; r++)); do
+		t=$( { time "$@" >/dev/null 2>&1; } 2>&1 )
+		if [ -z "$fastest" ] || awk -v a="$t" -v b="$fastest" 'BEGIN { exit !(a < b) }'; then fastest=$t; fi
+	done
+	"$@" >/dev/null 2>&1
+	echo "$fastest $?"
+}
+
+printf '%-12s %10s %10s %10s\n' program vm jit native
+for program in *.c; do
+	"$compiler" "$program" "$work/p.o" && gcc -no-pie -o "$work/p" "$work/p.o" || exit 1
+	read vm vm_exit < <(best "$compiler" -vm "$program")
+	read jit jit_exit < <(best "$compiler" -jit "$program")
+	read native native_exit < <(best "$work/p")
+	printf '%-12s %9ss %9ss %9ss\n' "$program" "$vm" "$jit" "$native"
+	if [ "$vm_exit" != "$native_exit" ] || [ "$jit_exit" != "$native_exit" ]; then
+		echo "exit codes differ: vm $vm_exit, jit $jit_exit, native $native_exit"
+		exit 1
+	fi
+done
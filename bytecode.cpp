@@ -0,0 +1,743 @@
+#include "ast.h"
+#include "vm.h"
+#include <algorithm>
+#include <climits>
+#include <unordered_map>
+
+// lowers the tree to bytecode for the interpreter in vm.cpp. values are 64 bit in registers
+// and narrower types are kept sign extended, so only stores to memory and writes to narrow
+// variables need to care about sizes. struct fields are 8 bytes apart as in native code
+
+struct bytecode_variable {
+	symbol name;
+	DataType type;
+	int reg;
+	bool by_address; // the register holds the variable's address, for struct parameters
+};
+
+// where the value of an expression ended up
+struct bytecode_value {
+	int reg = 0;
+	DataType type;
+	bool in_memory = false; // reg holds the address of the value
+	bool variable = false;  // reg is a variable's own register, so writing it assigns the variable
+};
+
+struct bytecode_loop {
+	std::vector<size_t> breaks, continues; // jumps still to be pointed at their targets
+};
+
+const int MAX_REGISTERS = 0xffff;
+
+inline bool is_struct(const DataType& t) {
+	return t.id > 4 && t.pointers == 0;
+}
+
+inline DataType rvalue(DataType t) {
+	t.lvalue = false;
+	return t;
+}
+
+inline DataType pointer_to(const DataType& t) {
+	return DataType(t.id, t.pointers + 1, false, 8);
+}
+
+inline DataType pointed_to(const DataType& t) {
+	return DataType(t.id, t.pointers - 1, false, t.sz);
+}
+
+// the operation on the values of a compound assignment
+binary_operator base_operator(binary_operator op) {
+	switch (op) {
+	case add_assign: return add;
+	case subtract_assign: return subtract;
+	case multiply_assign: return multiply;
+	case divide_assign: return divide;
+	case mod_assign: return mod;
+	case left_shift_assign: return left_shift;
+	case right_shift_assign: return right_shift;
+	case and_assign: return bitwise_and;
+	case or_assign: return bitwise_or;
+	case xor_assign: return bitwise_xor;
+	default: return op;
+	}
+}
+
+BytecodeOp bytecode_operator(binary_operator op) {
+	switch (op) {
+	case add: return BytecodeOp::Add;
+	case subtract: return BytecodeOp::Sub;
+	case multiply: return BytecodeOp::Mul;
+	case divide: return BytecodeOp::Div;
+	case mod: return BytecodeOp::Mod;
+	case bitwise_and: return BytecodeOp::And;
+	case bitwise_or: return BytecodeOp::Or;
+	case bitwise_xor: return BytecodeOp::Xor;
+	case left_shift: return BytecodeOp::Shl;
+	case right_shift: return BytecodeOp::Shr;
+	case equal: return BytecodeOp::Eq;
+	case not_equal: return BytecodeOp::Ne;
+	case less: return BytecodeOp::Lt;
+	case greater: return BytecodeOp::Gt;
+	case less_equal: return BytecodeOp::Le;
+	case greater_equal: return BytecodeOp::Ge;
+	default: throw std::exception("Operator isn't supported by the bytecode backend");
+	}
+}
+
+inline bool is_comparison(binary_operator op) {
+	return op >= equal && op <= greater_equal;
+}
+
+// instructions up to Load64 only write register a, so a result can be redirected to another register
+inline bool writes_register(BytecodeOp op) {
+	return op <= BytecodeOp::Load64;
+}
+
+struct bytecode_lowering {
+	Application& app;
+	bytecode_program& program;
+
+	std::unordered_map<symbol, int> functions; // defined functions by name
+	std::unordered_map<symbol, const Function*> declarations; // every function, for return and parameter types
+	std::unordered_map<int, const Struct*> structs; // by DataType id
+
+	std::vector<bytecode_variable> variables; // innermost last
+	std::vector<bytecode_loop> loops;
+	int locals = 0; // registers below hold parameters and variables, the rest are temporaries
+	int top = 0;    // the first free register
+	int max_registers = 0;
+	size_t last_target = 0; // the last instruction index a jump was pointed at
+
+	bytecode_lowering(Application& app, bytecode_program& program)
+		: app(app), program(program) {
+	}
+
+	int size_of(const DataType& t) {
+		if (t.pointers) return 8;
+		switch (t.id) {
+		case 0: return 0;
+		case 1: return 1;
+		case 2: return 2;
+		case 3: return 4;
+		case 4: return 8;
+		default: return 8 * (int)struct_of(t).fields.size();
+		}
+	}
+
+	const Struct& struct_of(const DataType& t) {
+		auto s = structs.find(t.id);
+		if (s == structs.end()) throw std::exception("Unknown struct");
+		return *s->second;
+	}
+
+	int temp() {
+		if (top >= MAX_REGISTERS) throw std::exception("Function needs too many registers");
+		int reg = top++;
+		if (top > max_registers) max_registers = top;
+		return reg;
+	}
+
+	size_t emit(BytecodeOp op, int a = 0, int b = 0, int c = 0) {
+		program.code.push_back({ op, (unsigned short)a, (unsigned short)b, (unsigned short)c });
+		return program.code.size() - 1;
+	}
+
+	size_t emit_wide(BytecodeOp op, int a, int wide) {
+		return emit(op, a, wide & 0xffff, (int)((unsigned int)wide >> 16));
+	}
+
+	// the index of the next instruction, which something is going to jump to
+	size_t here() {
+		last_target = program.code.size();
+		return last_target;
+	}
+
+	void patch(size_t jump, size_t target) {
+		program.code[jump].b = (unsigned short)(target & 0xffff);
+		program.code[jump].c = (unsigned short)(target >> 16);
+	}
+
+	void load_constant(int reg, long long value) {
+		if (value >= INT_MIN && value <= INT_MAX) emit_wide(BytecodeOp::LoadI, reg, (int)value);
+		else {
+			program.constants.push_back(value);
+			emit_wide(BytecodeOp::LoadK, reg, (int)program.constants.size() - 1);
+		}
+	}
+
+	// dst = src, redirecting the instruction that computed src when src is a temporary it
+	// just wrote and nothing jumps in between
+	void move(int dst, int src) {
+		if (dst == src) return;
+		if (src >= locals && !program.code.empty() && last_target != program.code.size()) {
+			BytecodeInstr& last = program.code.back();
+			if (writes_register(last.op) && last.a == src) {
+				last.a = (unsigned short)dst;
+				return;
+			}
+		}
+		emit(BytecodeOp::Mov, dst, src);
+	}
+
+	// dst = src converted to type t
+	void convert(int dst, int src, const DataType& t) {
+		if (t.pointers == 0 && t.id == 1) emit(BytecodeOp::Sext8, dst, src);
+		else if (t.pointers == 0 && t.id == 2) emit(BytecodeOp::Sext16, dst, src);
+		else if (t.pointers == 0 && t.id == 3) emit(BytecodeOp::Sext32, dst, src);
+		else move(dst, src);
+	}
+
+	// a register holding the value, a struct's being its address. a value in memory is
+	// loaded into a new register unless reuse allows overwriting its address
+	int read(const bytecode_value& v, bool reuse = true) {
+		if (!v.in_memory || is_struct(v.type)) return v.reg;
+		int dst = reuse && v.reg >= locals ? v.reg : temp();
+		int size = size_of(v.type);
+		emit(size == 1 ? BytecodeOp::Load8 : size == 2 ? BytecodeOp::Load16 : size == 4 ? BytecodeOp::Load32 : BytecodeOp::Load64, dst, v.reg);
+		return dst;
+	}
+
+	// assigns value to target and returns the register now holding the assigned value
+	int write(const bytecode_value& target, int value) {
+		if (is_struct(target.type)) throw std::exception("Struct assignment isn't supported by the bytecode backend");
+		if (target.in_memory) {
+			int size = size_of(target.type);
+			emit(size == 1 ? BytecodeOp::Store8 : size == 2 ? BytecodeOp::Store16 : size == 4 ? BytecodeOp::Store32 : BytecodeOp::Store64, target.reg, value);
+			return value;
+		}
+		if (!target.variable) throw std::exception("Assignment to something that isn't a variable");
+		convert(target.reg, value, target.type);
+		return target.reg;
+	}
+
+	// the result type of arithmetic, with char and short promoted to int as in C
+	DataType arithmetic_type(const DataType& l, const DataType& r) {
+		if (l.pointers) return rvalue(l);
+		if (r.pointers) return rvalue(r);
+		if (l.id == 4 || r.id == 4) return DataType::LONG;
+		return DataType::INT;
+	}
+
+	bool small_constant(node_index e, int& value) {
+		const Expression& exp = app.expressions[e];
+		long long v;
+		switch (exp.type) {
+		case ExpressionType::ConstantChar: v = (char)exp.a; break;
+		case ExpressionType::ConstantShort: v = (short)exp.a; break;
+		case ExpressionType::ConstantInt: v = (int)exp.a; break;
+		case ExpressionType::ConstantLong: v = (long long)(((unsigned long long)exp.b << 32) | exp.a); break;
+		default: return false;
+		}
+		if (v < -32768 || v > 32767) return false;
+		value = (int)v;
+		return true;
+	}
+
+	// dst = left op right on values of types l and r, scaling integers added to pointers by the
+	// size of what they point to. returns the result type
+	DataType arithmetic(binary_operator op, int dst, int left, const DataType& l, int right, const DataType& r) {
+		DataType type = is_comparison(op) ? DataType::INT : arithmetic_type(l, r);
+		if ((op == add || op == subtract) && (l.pointers || r.pointers)) {
+			if (l.pointers && r.pointers) {
+				// the difference of two pointers counts elements
+				int size = size_of(pointed_to(l));
+				emit(BytecodeOp::Sub, dst, left, right);
+				if (size > 1) {
+					int divisor = temp();
+					load_constant(divisor, size);
+					emit(BytecodeOp::Div, dst, dst, divisor);
+				}
+				return DataType::LONG;
+			}
+			bool pointer_left = l.pointers != 0;
+			int size = size_of(pointed_to(pointer_left ? l : r));
+			int& index = pointer_left ? right : left;
+			if (size > 1) {
+				int scaled = temp();
+				emit(BytecodeOp::MulI, scaled, index, size);
+				index = scaled;
+			}
+			emit(bytecode_operator(op), dst, left, right);
+			return type;
+		}
+		emit(bytecode_operator(op), dst, left, right);
+		if (!is_comparison(op) && type.pointers == 0 && type.id == 3) emit(BytecodeOp::Sext32, dst, dst);
+		return type;
+	}
+
+	bytecode_value value_in(int reg, const DataType& type) {
+		bytecode_value v;
+		v.reg = reg;
+		v.type = rvalue(type);
+		return v;
+	}
+
+	bytecode_value memory_at(int reg, const DataType& type) {
+		bytecode_value v = value_in(reg, type);
+		v.in_memory = true;
+		return v;
+	}
+
+	bytecode_value lower_variable_ref(const Expression& exp) {
+		symbol name = exp.a;
+		for (size_t i = variables.size(); i-- > 0;) {
+			const bytecode_variable& var = variables[i];
+			if (var.name != name) continue;
+			if (var.by_address) return memory_at(var.reg, var.type);
+			if (is_struct(var.type)) {
+				int address = temp();
+				emit(BytecodeOp::LocalAddr, address, var.reg);
+				return memory_at(address, var.type);
+			}
+			bytecode_value v = value_in(var.reg, var.type);
+			v.variable = true;
+			return v;
+		}
+		int reg = temp();
+		load_constant(reg, function_value(name));
+		return value_in(reg, DataType::LONG);
+	}
+
+	long long function_value(symbol name) {
+		auto f = functions.find(name);
+		if (f != functions.end()) return bytecode_function_value(f->second);
+		int host = find_host_function(symbol_name(name));
+		if (host < 0) throw std::exception("Unknown variable or function");
+		return host_function_value(host);
+	}
+
+	// the field called name of the struct at address, or a negative offset if there's none
+	int field_offset(const Struct& s, symbol name, DataType& type) {
+		for (size_t i = 0; i < s.fields.size(); i++) {
+			const Line& field = app.lines[s.fields[i]];
+			if (field.b == (node_index)name) {
+				type = app.types[field.c];
+				return 8 * (int)i;
+			}
+		}
+		return -1;
+	}
+
+	bytecode_value member(int address, const DataType& struct_type, symbol name) {
+		DataType type;
+		int offset = field_offset(struct_of(struct_type), name, type);
+		if (offset < 0) throw std::exception("Unknown struct field");
+		if (offset == 0) return memory_at(address, type);
+		int reg = address >= locals ? address : temp();
+		emit(BytecodeOp::AddI, reg, address, offset);
+		return memory_at(reg, type);
+	}
+
+	// the address of the struct a member access reads from
+	int struct_address(const Expression& exp, DataType& struct_type) {
+		bytecode_value object = lower(exp.a);
+		if (exp.type == ExpressionType::MemberAccess) {
+			struct_type = object.type;
+			return object.reg;
+		}
+		struct_type = pointed_to(object.type);
+		return read(object);
+	}
+
+	bytecode_value lower_binary_operator(const Expression& exp) {
+		binary_operator op = (binary_operator)exp.op;
+		int mark = top;
+		if (op == logical_and || op == logical_or) {
+			int result = temp();
+			emit_wide(BytecodeOp::LoadI, result, op == logical_or);
+			int left = read(lower(exp.a));
+			size_t skip = emit(op == logical_or ? BytecodeOp::Jnz : BytecodeOp::Jz, left);
+			int right = read(lower(exp.b));
+			emit(BytecodeOp::LNot, result, right);
+			emit(BytecodeOp::LNot, result, result);
+			patch(skip, here());
+			top = mark + 1;
+			return value_in(result, DataType::INT);
+		}
+		if (op == assignment) {
+			bytecode_value target = lower(exp.a);
+			int value = read(lower(exp.b));
+			int reg = write(target, value);
+			top = std::max(reg + 1, mark);
+			return value_in(reg, target.type);
+		}
+		if (op >= add_assign) {
+			bytecode_value target = lower(exp.a);
+			int current = read(target, false);
+			bytecode_value right = lower(exp.b);
+			int value = read(right);
+			int result = temp();
+			arithmetic(base_operator(op), result, current, target.type, value, right.type);
+			int reg = write(target, result);
+			return value_in(reg, target.type);
+		}
+
+		bytecode_value left = lower(exp.a);
+		int l = read(left);
+		int constant;
+		if ((op == add || op == subtract) && left.type.pointers == 0 && small_constant(exp.b, constant)) {
+			DataType type = arithmetic_type(left.type, app.expression_type(exp.b));
+			top = mark;
+			int result = temp();
+			emit(BytecodeOp::AddI, result, l, op == add ? constant : -constant);
+			if (type.id == 3) emit(BytecodeOp::Sext32, result, result);
+			return value_in(result, type);
+		}
+		bytecode_value right = lower(exp.b);
+		int r = read(right);
+		int result = mark;
+		if (result >= top) temp();
+		DataType type = arithmetic(op, result, l, left.type, r, right.type);
+		top = mark + 1;
+		return value_in(result, type);
+	}
+
+	bytecode_value lower_unary_operator(const Expression& exp) {
+		unary_operator op = (unary_operator)exp.op;
+		int mark = top;
+		bytecode_value v = lower(exp.a);
+		switch (op) {
+		case address:
+			if (v.in_memory) return value_in(v.reg, pointer_to(v.type));
+			if (!v.variable) throw std::exception("Address of something that isn't a variable");
+			{
+				top = mark;
+				int reg = temp();
+				emit(BytecodeOp::LocalAddr, reg, v.reg);
+				return value_in(reg, pointer_to(v.type));
+			}
+		case dereference: {
+			if (v.type.pointers == 0) throw std::exception("Dereference of something that isn't a pointer");
+			int address = read(v);
+			return memory_at(address, pointed_to(v.type));
+		}
+		case prefix_increment:
+		case prefix_decrement:
+		case postfix_increment:
+		case postfix_decrement: {
+			int delta = v.type.pointers ? size_of(pointed_to(v.type)) : 1;
+			if (op == prefix_decrement || op == postfix_decrement) delta = -delta;
+			bool postfix = op == postfix_increment || op == postfix_decrement;
+			int current = read(v, false);
+			int old = current;
+			if (postfix && v.variable) {
+				old = temp();
+				emit(BytecodeOp::Mov, old, current);
+			}
+			int updated = v.variable ? v.reg : temp();
+			emit(BytecodeOp::AddI, updated, current, delta);
+			int reg = write(v, updated);
+			return value_in(postfix ? old : reg, v.type);
+		}
+		default: {
+			int operand = read(v);
+			top = mark;
+			int result = temp();
+			DataType type = v.type.pointers ? DataType::LONG : arithmetic_type(v.type, DataType::INT);
+			if (op == plus) move(result, operand);
+			else if (op == logical_negation) {
+				emit(BytecodeOp::LNot, result, operand);
+				type = DataType::INT;
+			}
+			else {
+				emit(op == negation ? BytecodeOp::Neg : BytecodeOp::Not, result, operand);
+				if (type.id == 3) emit(BytecodeOp::Sext32, result, result);
+			}
+			return value_in(result, type);
+		}
+		}
+	}
+
+	// the result has the type of the first choice, as in native code, so the second one is
+	// converted to it
+	bytecode_value lower_ternary(const Expression& exp) {
+		int result = temp();
+		int condition = read(lower(exp.a));
+		size_t to_else = emit(BytecodeOp::Jz, condition);
+		top = result + 1;
+		bytecode_value if_value = lower(app.children[exp.b]);
+		move(result, read(if_value));
+		size_t to_end = emit(BytecodeOp::Jmp);
+		patch(to_else, here());
+		top = result + 1;
+		convert(result, read(lower(app.children[exp.b + 1])), if_value.type);
+		patch(to_end, here());
+		top = result + 1;
+		return value_in(result, if_value.type);
+	}
+
+	// evaluates an argument into its register, converted to the parameter type when it's known
+	void lower_argument(node_index e, int reg, const DataType* param) {
+		top = reg;
+		int value = read(lower(e));
+		if (param && !is_struct(*param) && !param->lvalue) convert(reg, value, *param);
+		else move(reg, value);
+		top = reg + 1;
+	}
+
+	bytecode_value lower_function_call(const Expression& exp) {
+		const Expression& callee = app.expressions[exp.a];
+		const node_index* args = app.children.data() + exp.b;
+		int count = exp.op;
+		int base = top;
+		const Function* declaration = nullptr;
+		int function = -1, host = -1, function_reg = -1;
+		bool method = false;
+
+		if (callee.type == ExpressionType::VariableRef) {
+			symbol name = callee.a;
+			bool variable = false;
+			for (const bytecode_variable& var : variables) variable = variable || var.name == name;
+			if (!variable) {
+				auto f = functions.find(name);
+				if (f != functions.end()) function = f->second;
+				else host = find_host_function(symbol_name(name));
+				if (function < 0 && host < 0) throw std::exception("Unknown function");
+				auto d = declarations.find(name);
+				if (d != declarations.end()) declaration = d->second;
+			}
+		}
+		else if (callee.type == ExpressionType::MemberAccess || callee.type == ExpressionType::PointerMemberAccess) {
+			// a method gets the address of its struct as the first argument, this
+			DataType struct_type;
+			int address = struct_address(callee, struct_type);
+			const Struct& s = struct_of(struct_type);
+			DataType field_type;
+			if (field_offset(s, callee.b, field_type) < 0) {
+				symbol name = intern(symbol_name(s.name) + "____" + symbol_name(callee.b));
+				auto f = functions.find(name);
+				if (f == functions.end()) throw std::exception("Unknown method");
+				function = f->second;
+				declaration = declarations[name];
+				method = true;
+				move(base, address);
+				top = base + 1;
+			}
+			else function_reg = read(member(address, struct_type, callee.b));
+		}
+		if (function < 0 && host < 0 && function_reg < 0) function_reg = read(lower(exp.a));
+		if (function_reg >= 0) base = top;
+
+		int first = method ? 1 : 0;
+		if (declaration && declaration->params.size() != (size_t)(count + first)) throw std::exception("Wrong number of arguments");
+		for (int i = 0; i < count; i++) {
+			lower_argument(args[i], base + first + i, declaration ? &declaration->params[first + i].second : nullptr);
+		}
+		if (function >= 0) emit_wide(BytecodeOp::Call, base, function);
+		else if (host >= 0) emit(BytecodeOp::CallHost, base, host, count);
+		else emit(BytecodeOp::CallR, base, function_reg, count + first);
+		// the callee's registers start at base, so everything above it is overwritten
+		top = base;
+		temp();
+		return value_in(base, declaration ? declaration->return_type : DataType::LONG);
+	}
+
+	bytecode_value lower(node_index e) {
+		const Expression& exp = app.expressions[e];
+		switch (exp.type) {
+		case ExpressionType::BinaryOperator: return lower_binary_operator(exp);
+		case ExpressionType::UnaryOperator: return lower_unary_operator(exp);
+		case ExpressionType::Ternary: return lower_ternary(exp);
+		case ExpressionType::FunctionCall: return lower_function_call(exp);
+		case ExpressionType::VariableRef: return lower_variable_ref(exp);
+		case ExpressionType::MemberAccess:
+		case ExpressionType::PointerMemberAccess: {
+			DataType struct_type;
+			int address = struct_address(exp, struct_type);
+			return member(address, struct_type, exp.b);
+		}
+		case ExpressionType::ConstantChar:
+		case ExpressionType::ConstantShort:
+		case ExpressionType::ConstantInt:
+		case ExpressionType::ConstantLong: {
+			int reg = temp();
+			long long value = exp.type == ExpressionType::ConstantChar ? (char)exp.a
+				: exp.type == ExpressionType::ConstantShort ? (short)exp.a
+				: exp.type == ExpressionType::ConstantInt ? (int)exp.a
+				: (long long)(((unsigned long long)exp.b << 32) | exp.a);
+			load_constant(reg, value);
+			return value_in(reg, app.expression_type(e));
+		}
+		case ExpressionType::ConstantString: {
+			int reg = temp();
+			program.strings.push_back(app.strings[exp.a]);
+			emit_wide(BytecodeOp::String, reg, (int)program.strings.size() - 1);
+			return value_in(reg, DataType::CHAR_PTR);
+		}
+		}
+		throw std::exception("Unknown expression");
+	}
+
+	void add_variable(symbol name, const DataType& type, int reg, bool by_address) {
+		variables.push_back({ name, type, reg, by_address });
+	}
+
+	void lower_variable_declaration(const Line& line) {
+		symbol name = line.b;
+		DataType type = app.types[line.c];
+		if (is_struct(type)) {
+			int words = size_of(type) / 8;
+			for (int i = 0; i < words; i++) emit_wide(BytecodeOp::LoadI, temp(), 0);
+			locals = top;
+			// registers go down in memory, so the struct starts at its last one
+			add_variable(name, type, top - 1, false);
+			return;
+		}
+		int reg = temp();
+		locals = top;
+		if (line.a == NO_NODE) emit_wide(BytecodeOp::LoadI, reg, 0);
+		else {
+			bytecode_value v = value_in(reg, type);
+			v.variable = true;
+			write(v, read(lower(line.a)));
+		}
+		add_variable(name, type, reg, false);
+	}
+
+	void lower_condition_jump(node_index condition, size_t target) {
+		emit_wide(BytecodeOp::Jnz, read(lower(condition)), (int)target);
+		top = locals;
+	}
+
+	// loops are laid out with the condition at the bottom, so each iteration takes one jump
+	void lower_loop(node_index initial, node_index condition, node_index post, node_index inner, bool test_first) {
+		size_t variable_count = variables.size();
+		int saved_locals = locals;
+		if (initial != NO_NODE) lower_line(initial);
+		size_t to_condition = test_first ? emit(BytecodeOp::Jmp) : 0;
+		size_t body = here();
+		loops.push_back(bytecode_loop());
+		lower_line(inner);
+		size_t continue_target = here();
+		if (post != NO_NODE) {
+			lower(post);
+			top = locals;
+		}
+		size_t condition_start = here();
+		if (test_first) patch(to_condition, condition_start);
+		if (condition != NO_NODE) lower_condition_jump(condition, body);
+		else emit_wide(BytecodeOp::Jmp, 0, (int)body);
+		size_t end = here();
+		for (size_t jump : loops.back().breaks) patch(jump, end);
+		for (size_t jump : loops.back().continues) patch(jump, continue_target);
+		loops.pop_back();
+		variables.resize(variable_count);
+		locals = saved_locals;
+		top = locals;
+	}
+
+	void lower_line(node_index l) {
+		const Line& line = app.lines[l];
+		switch (line.type) {
+		case LineType::Return: {
+			int reg;
+			if (line.a != NO_NODE) {
+				reg = read(lower(line.a));
+				const DataType& type = current_return_type;
+				if (type.pointers == 0 && type.id >= 1 && type.id <= 3) {
+					int converted = temp();
+					convert(converted, reg, type);
+					reg = converted;
+				}
+			}
+			else {
+				reg = temp();
+				emit_wide(BytecodeOp::LoadI, reg, 0);
+			}
+			emit(BytecodeOp::Ret, reg);
+			break;
+		}
+		case LineType::Expression:
+			if (line.a != NO_NODE) lower(line.a);
+			break;
+		case LineType::VariableDeclaration:
+			lower_variable_declaration(line);
+			break;
+		case LineType::If: {
+			size_t to_else = emit(BytecodeOp::Jz, read(lower(line.a)));
+			top = locals;
+			lower_line(line.b);
+			if (line.c == NO_NODE) {
+				patch(to_else, here());
+				break;
+			}
+			size_t to_end = emit(BytecodeOp::Jmp);
+			patch(to_else, here());
+			lower_line(line.c);
+			patch(to_end, here());
+			break;
+		}
+		case LineType::Block: {
+			size_t variable_count = variables.size();
+			int saved_locals = locals;
+			for (node_index i = 0; i < line.b; i++) lower_line(app.children[line.a + i]);
+			variables.resize(variable_count);
+			locals = saved_locals;
+			break;
+		}
+		case LineType::For:
+			lower_loop(line.a, line.b, app.children[line.c], app.children[line.c + 1], true);
+			break;
+		case LineType::While:
+			lower_loop(NO_NODE, line.a, NO_NODE, line.b, true);
+			break;
+		case LineType::DoWhile:
+			lower_loop(NO_NODE, line.a, NO_NODE, line.b, false);
+			break;
+		case LineType::Break:
+		case LineType::Continue:
+			if (loops.empty()) throw std::exception("break or continue outside of a loop");
+			(line.type == LineType::Break ? loops.back().breaks : loops.back().continues).push_back(emit(BytecodeOp::Jmp));
+			break;
+		}
+		top = locals;
+	}
+
+	DataType current_return_type;
+
+	void lower_function(const Function& f, bytecode_function& out) {
+		variables.clear();
+		for (size_t i = 0; i < f.params.size(); i++) {
+			add_variable(f.params[i].first, f.params[i].second, (int)i, f.params[i].second.lvalue);
+		}
+		locals = top = max_registers = (int)f.params.size();
+		current_return_type = f.return_type;
+		out.start = (unsigned int)here();
+		out.params = (unsigned short)f.params.size();
+		lower_line(f.lines);
+		// falling off the end returns 0
+		int reg = temp();
+		emit_wide(BytecodeOp::LoadI, reg, 0);
+		emit(BytecodeOp::Ret, reg);
+		out.registers = (unsigned short)max_registers;
+	}
+
+	void lower_application() {
+		std::vector<const Function*> bodies;
+		auto add_function = [&](const Function& f) {
+			declarations[f.name] = &f;
+			if (f.lines == NO_NODE) return;
+			functions[f.name] = (int)bodies.size();
+			bodies.push_back(&f);
+		};
+		for (const Declaration& declaration : app.declarations) {
+			if (declaration.type == DeclarationType::Struct) {
+				const Struct& s = app.structs[declaration.index];
+				structs[s.id] = &s;
+				for (node_index f : s.functions) add_function(app.functions[f]);
+			}
+			else add_function(app.functions[declaration.index]);
+		}
+		program.functions.resize(bodies.size());
+		for (size_t i = 0; i < bodies.size(); i++) {
+			program.functions[i].name = bodies[i]->name;
+			lower_function(*bodies[i], program.functions[i]);
+		}
+	}
+};
+
+void Application::generateBytecode(bytecode_program& program) {
+	bytecode_lowering lowering(*this, program);
+	lowering.lower_application();
+}
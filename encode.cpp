@@ -0,0 +1,330 @@
+#include "encode.h"
+#include <unordered_map>
+
+// the hardware number of each register, in the order of reg
+const unsigned char register_numbers[] = { 0, 3, 1, 2, 8, 9, 4, 5, 6, 7, 10, 11, 12, 13, 14, 15 };
+
+// the 8 bit forms of the arithmetic instructions, each of which also has a /digit
+// extension for the immediate forms 80, 81 and 83
+const unsigned char arithmetic_opcodes[][2] = {
+	// add, or, and, sub, xor, cmp
+	{ 0x00, 0 }, { 0x08, 1 }, { 0x20, 4 }, { 0x28, 5 }, { 0x30, 6 }, { 0x38, 7 }
+};
+
+// the second opcode byte of each setcc, from Sete to Setge
+const unsigned char set_opcodes[] = { 0x94, 0x95, 0x9c, 0x9f, 0x9e, 0x9d };
+// the short form of each jump, from Jmp to Jge. the 32 bit conditional jumps are 0x0f and
+// 0x10 more
+const unsigned char jump_opcodes[] = { 0xeb, 0x74, 0x75, 0x7c, 0x7f, 0x7e, 0x7d };
+
+// Padd and Psub of each element size
+const unsigned char vector_add_opcodes[] = { 0xfc, 0xfd, 0xfe, 0xd4 };
+const unsigned char vector_subtract_opcodes[] = { 0xf8, 0xf9, 0xfa, 0xfb };
+
+struct label_fixup {
+	unsigned int offset; // of the 32 bit displacement
+	unsigned long long label;
+};
+
+inline int number(const MachineOperand& o) {
+	if (o.type == OperandType::Xmm || o.type == OperandType::Ymm) return o.value;
+	return register_numbers[o.r];
+}
+
+inline bool fits_byte(long long value) {
+	return value >= -128 && value <= 127;
+}
+
+inline unsigned long long label_key(const MachineOperand& o) {
+	return (unsigned long long)o.label << 32 | (unsigned int)o.value;
+}
+
+void append_immediate(std::vector<unsigned char>& text, int value, int bytes) {
+	for (int i = 0; i < bytes; i++) text.push_back((unsigned char)(value >> (8 * i)));
+}
+
+// the ModRM byte of reg and rm, and the SIB byte and displacement when rm is memory
+void append_modrm(std::vector<unsigned char>& text, int reg, const MachineOperand& rm) {
+	int base = number(rm);
+	if (rm.type != OperandType::Memory) {
+		text.push_back((unsigned char)(0xc0 | (reg & 7) << 3 | (base & 7)));
+		return;
+	}
+	// rbp as a base has no form without a displacement, and rsp needs an SIB byte
+	int mod = rm.value == 0 && (base & 7) != 5 ? 0 : fits_byte(rm.value) ? 1 : 2;
+	text.push_back((unsigned char)(mod << 6 | (reg & 7) << 3 | (base & 7)));
+	if ((base & 7) == 4) text.push_back(0x24);
+	if (mod == 1) append_immediate(text, rm.value, 1);
+	if (mod == 2) append_immediate(text, rm.value, 4);
+}
+
+// an SSE instruction, whose mandatory prefix (0x66 or 0xf3, or 0 for none) goes ahead of
+// any REX prefix, or its 256 bit AVX form when vex is set, where the VEX prefix holds the
+// same prefix and REX bits along with vvvv, an extra source register. map is the byte after
+// 0x0f for the longer opcode maps, or 0. wide is REX.W or VEX.W
+void append_vector_rm(std::vector<unsigned char>& text, unsigned char prefix, unsigned char map, unsigned char opcode, int reg, const MachineOperand& rm,
+	bool vex = false, int vvvv = 0, bool wide = false) {
+	if (rm.type != OperandType::Register && rm.type != OperandType::Memory && rm.type != OperandType::Xmm && rm.type != OperandType::Ymm) {
+		throw std::exception("Instruction can't be encoded");
+	}
+	int base = number(rm);
+	if (vex) {
+		text.push_back(0xc4);
+		// R, X and B are inverted, and so is vvvv
+		text.push_back((unsigned char)((reg >= 8 ? 0 : 0x80) | 0x40 | (base >= 8 ? 0 : 0x20) | (map == 0x3a ? 3 : map == 0x38 ? 2 : 1)));
+		int pp = prefix == 0x66 ? 1 : prefix == 0xf3 ? 2 : 0;
+		text.push_back((unsigned char)((wide ? 0x80 : 0) | (~vvvv & 15) << 3 | 4 | pp));
+	}
+	else {
+		if (prefix) text.push_back(prefix);
+		unsigned char rex = 0x40;
+		if (wide) rex |= 0x08;
+		if (reg >= 8) rex |= 0x04;
+		if (base >= 8) rex |= 0x01;
+		if (rex != 0x40) text.push_back(rex);
+		text.push_back(0x0f);
+		if (map) text.push_back(map);
+	}
+	text.push_back(opcode);
+	append_modrm(text, reg, rm);
+}
+
+// the prefixes, opcode and ModRM byte of an instruction on rm, which is a register or
+// memory. reg is the register number or opcode extension in the ModRM reg field
+void append_rm(std::vector<unsigned char>& text, size s, std::initializer_list<unsigned char> opcode, int reg, bool reg_is_register, const MachineOperand& rm) {
+	if (rm.type != OperandType::Register && rm.type != OperandType::Memory) throw std::exception("Instruction can't be encoded");
+	int base = number(rm);
+	if (s == i16) text.push_back(0x66);
+	unsigned char rex = 0x40;
+	if (s == i64) rex |= 0x08;
+	if (reg_is_register && reg >= 8) rex |= 0x04;
+	if (base >= 8) rex |= 0x01;
+	// without a REX prefix, numbers 4 to 7 are the high byte registers instead of spl and bpl
+	bool byte_needs_rex = s == i8 && ((reg_is_register && reg >= 4) || (rm.type == OperandType::Register && base >= 4));
+	if (rex != 0x40 || byte_needs_rex) text.push_back(rex);
+	text.insert(text.end(), opcode);
+	append_modrm(text, reg, rm);
+}
+
+// a register or memory operand, extended to a byte register or the full size by opcode
+inline void append_sized_rm(std::vector<unsigned char>& text, size s, unsigned char byte_opcode, int reg, bool reg_is_register, const MachineOperand& rm) {
+	append_rm(text, s, { (unsigned char)(s == i8 ? byte_opcode : byte_opcode + 1) }, reg, reg_is_register, rm);
+}
+
+// immediates are at most 32 bits and sign extended for 64 bit instructions
+inline int immediate_size(size s) {
+	return s == i64 ? 4 : _bytes(s);
+}
+
+void encode_instruction(const MachineInstr& in, object_file& obj, std::unordered_map<unsigned long long, unsigned int>& labels, std::vector<label_fixup>& fixups) {
+	std::vector<unsigned char>& text = obj.text;
+	const MachineOperand& src = in.src;
+	const MachineOperand& dst = in.dst;
+	switch (in.op) {
+	case Opcode::Mov:
+		if (src.type == OperandType::Immediate) {
+			append_sized_rm(text, in.s, 0xc6, 0, false, dst);
+			append_immediate(text, src.value, immediate_size(in.s));
+		}
+		else if (src.type == OperandType::SymbolAddress) {
+			append_sized_rm(text, in.s, 0xc6, 0, false, dst);
+			obj.relocations.push_back({ (unsigned int)text.size(), obj.symbol_index(src.value), RelocationType::Absolute32, 0 });
+			append_immediate(text, 0, 4);
+		}
+		else if (src.type == OperandType::Register) append_sized_rm(text, in.s, 0x88, number(src), true, dst);
+		else append_sized_rm(text, in.s, 0x8a, number(dst), true, src);
+		break;
+	case Opcode::Lea:
+		append_rm(text, in.s, { 0x8d }, number(dst), true, src);
+		break;
+	case Opcode::Add:
+	case Opcode::Or:
+	case Opcode::And:
+	case Opcode::Sub:
+	case Opcode::Xor:
+	case Opcode::Cmp: {
+		int i = in.op == Opcode::Add ? 0 : in.op == Opcode::Or ? 1 : in.op == Opcode::And ? 2 : in.op == Opcode::Sub ? 3 : in.op == Opcode::Xor ? 4 : 5;
+		if (src.type == OperandType::Immediate) {
+			if (in.s != i8 && fits_byte(src.value)) {
+				append_rm(text, in.s, { 0x83 }, arithmetic_opcodes[i][1], false, dst);
+				append_immediate(text, src.value, 1);
+			}
+			else {
+				append_sized_rm(text, in.s, 0x80, arithmetic_opcodes[i][1], false, dst);
+				append_immediate(text, src.value, immediate_size(in.s));
+			}
+		}
+		else if (src.type == OperandType::Register) append_sized_rm(text, in.s, arithmetic_opcodes[i][0], number(src), true, dst);
+		else append_sized_rm(text, in.s, arithmetic_opcodes[i][0] + 2, number(dst), true, src);
+		break;
+	}
+	case Opcode::Imul:
+		if (src.type == OperandType::None) {
+			append_sized_rm(text, in.s, 0xf6, 5, false, dst);
+			break;
+		}
+		// imul has no 8 bit two operand form and always writes a register
+		if (in.s == i8 || dst.type != OperandType::Register) throw std::exception("Instruction can't be encoded");
+		if (src.type == OperandType::Immediate) {
+			bool short_immediate = fits_byte(src.value);
+			append_rm(text, in.s, { (unsigned char)(short_immediate ? 0x6b : 0x69) }, number(dst), true, dst);
+			append_immediate(text, src.value, short_immediate ? 1 : immediate_size(in.s));
+		}
+		else append_rm(text, in.s, { 0x0f, 0xaf }, number(dst), true, src);
+		break;
+	case Opcode::Idiv:
+		append_sized_rm(text, in.s, 0xf6, 7, false, dst);
+		break;
+	case Opcode::Movsx:
+		if (in.s == i32) append_rm(text, i64, { 0x63 }, number(dst), true, src);
+		else append_rm(text, i64, { 0x0f, (unsigned char)(in.s == i8 ? 0xbe : 0xbf) }, number(dst), true, src);
+		break;
+	case Opcode::Cqo:
+		text.push_back(0x48);
+		text.push_back(0x99);
+		break;
+	case Opcode::Neg:
+		append_sized_rm(text, in.s, 0xf6, 3, false, dst);
+		break;
+	case Opcode::Not:
+		append_sized_rm(text, in.s, 0xf6, 2, false, dst);
+		break;
+	case Opcode::Inc:
+		append_sized_rm(text, in.s, 0xfe, 0, false, dst);
+		break;
+	case Opcode::Dec:
+		append_sized_rm(text, in.s, 0xfe, 1, false, dst);
+		break;
+	case Opcode::Sal:
+	case Opcode::Sar:
+	case Opcode::Shr: {
+		int extension = in.op == Opcode::Sal ? 4 : in.op == Opcode::Sar ? 7 : 5;
+		// a shift by 1 has a form without the immediate
+		if (src.type == OperandType::Immediate && src.value == 1) append_sized_rm(text, in.s, 0xd0, extension, false, dst);
+		else if (src.type == OperandType::Immediate) {
+			append_sized_rm(text, in.s, 0xc0, extension, false, dst);
+			append_immediate(text, src.value, 1);
+		}
+		else if (src.type == OperandType::Register && src.r == rcx) append_sized_rm(text, in.s, 0xd2, extension, false, dst);
+		else throw std::exception("Instruction can't be encoded");
+		break;
+	}
+	case Opcode::Sete:
+	case Opcode::Setne:
+	case Opcode::Setl:
+	case Opcode::Setg:
+	case Opcode::Setle:
+	case Opcode::Setge:
+		append_rm(text, i8, { 0x0f, set_opcodes[(int)in.op - (int)Opcode::Sete] }, 0, false, dst);
+		break;
+	// push, pop and indirect calls are 64 bit without a REX.W prefix
+	case Opcode::Push:
+		if (dst.type == OperandType::Register) {
+			if (number(dst) >= 8) text.push_back(0x41);
+			text.push_back((unsigned char)(0x50 + (number(dst) & 7)));
+		}
+		else if (dst.type == OperandType::Immediate) {
+			text.push_back(fits_byte(dst.value) ? 0x6a : 0x68);
+			append_immediate(text, dst.value, fits_byte(dst.value) ? 1 : 4);
+		}
+		else append_rm(text, i32, { 0xff }, 6, false, dst);
+		break;
+	case Opcode::Pop:
+		if (dst.type == OperandType::Register) {
+			if (number(dst) >= 8) text.push_back(0x41);
+			text.push_back((unsigned char)(0x58 + (number(dst) & 7)));
+		}
+		else append_rm(text, i32, { 0x8f }, 0, false, dst);
+		break;
+	case Opcode::Jmp:
+	case Opcode::Je:
+	case Opcode::Jne:
+	case Opcode::Jl:
+	case Opcode::Jg:
+	case Opcode::Jle:
+	case Opcode::Jge: {
+		unsigned char short_opcode = jump_opcodes[(int)in.op - (int)Opcode::Jmp];
+		auto label = labels.find(label_key(dst));
+		// backward jumps know their distance, forward ones get a 32 bit displacement
+		if (label != labels.end() && fits_byte((long long)label->second - (long long)(text.size() + 2))) {
+			text.push_back(short_opcode);
+			text.push_back((unsigned char)(label->second - (text.size() + 1)));
+			break;
+		}
+		if (in.op == Opcode::Jmp) text.push_back(0xe9);
+		else {
+			text.push_back(0x0f);
+			text.push_back((unsigned char)(short_opcode + 0x10));
+		}
+		fixups.push_back({ (unsigned int)text.size(), label_key(dst) });
+		append_immediate(text, 0, 4);
+		break;
+	}
+	case Opcode::Call:
+		if (dst.type == OperandType::Symbol) {
+			text.push_back(0xe8);
+			// the displacement is from the end of the instruction, 4 bytes past the field
+			obj.relocations.push_back({ (unsigned int)text.size(), obj.symbol_index(dst.value), RelocationType::Call, -4 });
+			append_immediate(text, 0, 4);
+		}
+		else append_rm(text, i32, { 0xff }, 2, false, dst);
+		break;
+	case Opcode::Ret:
+		text.push_back(0xc3);
+		break;
+	case Opcode::Movdqu: {
+		bool vex = src.type == OperandType::Ymm || dst.type == OperandType::Ymm;
+		if (dst.type == OperandType::Memory) append_vector_rm(text, 0xf3, 0, 0x7f, number(src), dst, vex);
+		else append_vector_rm(text, 0xf3, 0, 0x6f, number(dst), src, vex);
+		break;
+	}
+	case Opcode::Padd:
+	case Opcode::Psub:
+	case Opcode::Pand:
+	case Opcode::Por:
+	case Opcode::Pxor: {
+		unsigned char opcode = in.op == Opcode::Padd ? vector_add_opcodes[in.s] : in.op == Opcode::Psub ? vector_subtract_opcodes[in.s]
+			: in.op == Opcode::Pand ? 0xdb : in.op == Opcode::Por ? 0xeb : 0xef;
+		append_vector_rm(text, 0x66, 0, opcode, number(dst), src, dst.type == OperandType::Ymm, number(dst));
+		break;
+	}
+	case Opcode::Psrldq:
+		append_vector_rm(text, 0x66, 0, 0x73, 3, dst);
+		append_immediate(text, src.value, 1);
+		break;
+	case Opcode::Movq:
+		append_vector_rm(text, 0x66, 0, 0x7e, number(src), dst, false, 0, true);
+		break;
+	case Opcode::Vextracti128:
+		append_vector_rm(text, 0x66, 0x3a, 0x39, number(src), dst, true);
+		append_immediate(text, 1, 1);
+		break;
+	case Opcode::Vzeroupper:
+		text.insert(text.end(), { 0xc5, 0xf8, 0x77 });
+		break;
+	case Opcode::Label:
+		if (dst.type == OperandType::Symbol) {
+			object_symbol& s = obj.symbols[obj.symbol_index(dst.value)];
+			if (s.defined) throw std::exception("Symbol defined twice");
+			s.defined = true;
+			s.offset = (unsigned int)text.size();
+		}
+		else labels[label_key(dst)] = (unsigned int)text.size();
+		break;
+	case Opcode::Globl:
+		obj.symbols[obj.symbol_index(dst.value)].global = true;
+		break;
+	}
+}
+
+void encode_instructions(const std::vector<MachineInstr>& code, object_file& obj) {
+	std::unordered_map<unsigned long long, unsigned int> labels;
+	std::vector<label_fixup> fixups;
+	for (const MachineInstr& in : code) encode_instruction(in, obj, labels, fixups);
+	for (const label_fixup& fixup : fixups) {
+		auto label = labels.find(fixup.label);
+		if (label == labels.end()) throw std::exception("Jump to an undefined label");
+		int displacement = (int)label->second - (int)(fixup.offset + 4);
+		for (int i = 0; i < 4; i++) obj.text[fixup.offset + i] = (unsigned char)(displacement >> (8 * i));
+	}
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <vector>
+#include "machine.h"
+#include "object.h"
+
+// encodes instructions into x86-64 machine code at the end of the object's .text. labels
+// are resolved within one call, so code has to hold whole functions, while symbols are
+// added to the object's symbol table and every use of one becomes a relocation
+void encode_instructions(const std::vector<MachineInstr>& code, object_file& obj);
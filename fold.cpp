@@ -0,0 +1,326 @@
+#include "ast.h"
+#include <climits>
+#include <unordered_map>
+
+// folds constant subtrees of the tree into single constants, with the widths C gives them:
+// char and short promote to int, int wraps at 32 bits and long at 64. operations whose result
+// depends on the machine, division by 0, the most negative number divided by -1 and shifts
+// by the width or more, are left for run time. a local that's only ever given one constant,
+// by its declaration or by an assignment right after it, and whose address is never taken,
+// is replaced by that constant wherever it's read, which can make more subtrees constant, so
+// functions are folded until nothing changes
+
+struct folded_variable {
+	DataType type;
+	bool modified = false; // written other than by its definition, or its address taken
+	bool known = false;    // its definition is constant
+	long long value = 0;
+	node_index definition = NO_NODE; // the assignment right after a declaration without one
+	std::vector<node_index> reads;
+};
+
+struct constant_folding {
+	Application& app;
+	std::vector<std::pair<symbol, node_index>> scope; // the declaring line of each name, innermost last
+	std::unordered_map<node_index, folded_variable> variables; // by declaring line
+
+	constant_folding(Application& app)
+		: app(app) {
+	}
+
+	static bool is_integer(const DataType& t) {
+		return t.pointers == 0 && t.id >= 1 && t.id <= 4;
+	}
+
+	static long long wrap(long long v, const DataType& t) {
+		switch (t.id) {
+		case 1: return (char)v;
+		case 2: return (short)v;
+		case 3: return (int)v;
+		default: return v;
+		}
+	}
+
+	// the result type of arithmetic, with char and short promoted to int
+	static DataType arithmetic_type(const DataType& l, const DataType& r) {
+		return l.id == 4 || r.id == 4 ? DataType::LONG : DataType::INT;
+	}
+
+	bool constant(node_index e, long long& value) {
+		const Expression& exp = app.expressions[e];
+		switch (exp.type) {
+		case ExpressionType::ConstantChar: value = (char)exp.a; return true;
+		case ExpressionType::ConstantShort: value = (short)exp.a; return true;
+		case ExpressionType::ConstantInt: value = (int)exp.a; return true;
+		case ExpressionType::ConstantLong: value = (long long)(((unsigned long long)exp.b << 32) | exp.a); return true;
+		default: return false;
+		}
+	}
+
+	// turns e into the constant value of type
+	void set_constant(node_index e, long long value, const DataType& type) {
+		value = wrap(value, type);
+		Expression& exp = app.expressions[e];
+		exp.op = 0;
+		exp.a = (node_index)value;
+		exp.b = type.id == 4 ? (node_index)(value >> 32) : NO_NODE;
+		switch (type.id) {
+		case 1: exp.type = ExpressionType::ConstantChar; exp.return_type = app.type_id(DataType::CHAR); break;
+		case 2: exp.type = ExpressionType::ConstantShort; exp.return_type = app.type_id(DataType::SHORT); break;
+		case 3: exp.type = ExpressionType::ConstantInt; exp.return_type = app.type_id(DataType::INT); break;
+		default: exp.type = ExpressionType::ConstantLong; exp.return_type = app.type_id(DataType::LONG); break;
+		}
+	}
+
+	// l op r at type, false if it can't be known before run time
+	static bool evaluate(binary_operator op, long long l, long long r, const DataType& type, long long& result) {
+		int bits = type.id == 4 ? 64 : 32;
+		long long smallest = type.id == 4 ? LLONG_MIN : INT_MIN;
+		unsigned long long ul = (unsigned long long)l, ur = (unsigned long long)r;
+		switch (op) {
+		case add: result = (long long)(ul + ur); break;
+		case subtract: result = (long long)(ul - ur); break;
+		case multiply: result = (long long)(ul * ur); break;
+		case divide:
+		case mod:
+			if (r == 0 || (l == smallest && r == -1)) return false;
+			result = op == divide ? l / r : l % r;
+			break;
+		case bitwise_and: result = l & r; break;
+		case bitwise_or: result = l | r; break;
+		case bitwise_xor: result = l ^ r; break;
+		case left_shift:
+		case right_shift:
+			if (r < 0 || r >= bits) return false;
+			result = op == left_shift ? (long long)(ul << r) : l >> r;
+			break;
+		case equal: result = l == r; break;
+		case not_equal: result = l != r; break;
+		case less: result = l < r; break;
+		case greater: result = l > r; break;
+		case less_equal: result = l <= r; break;
+		case greater_equal: result = l >= r; break;
+		default: return false;
+		}
+		return true;
+	}
+
+	folded_variable* find_variable(symbol name) {
+		for (size_t i = scope.size(); i-- > 0;) {
+			if (scope[i].first != name) continue;
+			if (scope[i].second == NO_NODE) return nullptr; // a parameter
+			return &variables[scope[i].second];
+		}
+		return nullptr;
+	}
+
+	// a variable written by the expression e
+	void write(node_index e, node_index assignment = NO_NODE) {
+		const Expression& exp = app.expressions[e];
+		if (exp.type != ExpressionType::VariableRef) {
+			fold(e);
+			return;
+		}
+		folded_variable* var = find_variable(exp.a);
+		if (!var) return;
+		if (assignment != NO_NODE && assignment == var->definition) {
+			long long value = 0;
+			var->known = constant(app.expressions[assignment].b, value);
+			var->value = wrap(value, var->type);
+		}
+		else var->modified = true;
+	}
+
+	void fold_binary_operator(node_index e) {
+		const Expression exp = app.expressions[e];
+		binary_operator op = (binary_operator)exp.op;
+		if (op == assignment || op >= add_assign) {
+			fold(exp.b);
+			write(exp.a, op == assignment ? e : NO_NODE);
+			return;
+		}
+		fold(exp.a);
+		fold(exp.b);
+		long long l = 0, r = 0;
+		bool left_constant = constant(exp.a, l), right_constant = constant(exp.b, r);
+		if (op == logical_and || op == logical_or) {
+			// the right side only matters when the left one doesn't decide
+			if (!left_constant) return;
+			if ((op == logical_and) == (l == 0)) set_constant(e, op == logical_or, DataType::INT);
+			else if (right_constant) set_constant(e, r != 0, DataType::INT);
+			return;
+		}
+		if (!left_constant || !right_constant) return;
+		DataType type = arithmetic_type(app.expression_type(exp.a), app.expression_type(exp.b));
+		long long result;
+		if (!evaluate(op, wrap(l, type), wrap(r, type), type, result)) return;
+		set_constant(e, result, op >= equal && op <= greater_equal ? DataType::INT : type);
+	}
+
+	void fold_unary_operator(node_index e) {
+		const Expression exp = app.expressions[e];
+		unary_operator op = (unary_operator)exp.op;
+		switch (op) {
+		case address:
+		case prefix_increment:
+		case prefix_decrement:
+		case postfix_increment:
+		case postfix_decrement:
+			write(exp.a);
+			return;
+		case dereference:
+			fold(exp.a);
+			return;
+		default:
+			break;
+		}
+		fold(exp.a);
+		long long v;
+		if (!constant(exp.a, v)) return;
+		DataType type = arithmetic_type(app.expression_type(exp.a), DataType::INT);
+		switch (op) {
+		case negation: set_constant(e, (long long)(0 - (unsigned long long)v), type); break;
+		case plus: set_constant(e, v, type); break;
+		case bitwise_complement: set_constant(e, ~v, type); break;
+		default: set_constant(e, v == 0, DataType::INT); break;
+		}
+	}
+
+	void fold(node_index e) {
+		if (e == NO_NODE) return;
+		const Expression exp = app.expressions[e];
+		switch (exp.type) {
+		case ExpressionType::BinaryOperator:
+			fold_binary_operator(e);
+			break;
+		case ExpressionType::UnaryOperator:
+			fold_unary_operator(e);
+			break;
+		case ExpressionType::Ternary: {
+			node_index if_exp = app.children[exp.b], else_exp = app.children[exp.b + 1];
+			fold(exp.a);
+			fold(if_exp);
+			fold(else_exp);
+			// the result has the type of the first choice, so that one has to be constant too
+			long long condition, if_value, else_value;
+			if (!constant(exp.a, condition) || !constant(if_exp, if_value)) break;
+			DataType type = app.expression_type(if_exp);
+			if (condition != 0) set_constant(e, if_value, type);
+			else if (constant(else_exp, else_value)) set_constant(e, else_value, type);
+			break;
+		}
+		case ExpressionType::FunctionCall:
+			// a called name is a function, not a read
+			if (app.expressions[exp.a].type != ExpressionType::VariableRef) fold(exp.a);
+			for (node_index i = 0; i < exp.op; i++) fold(app.children[exp.b + i]);
+			break;
+		case ExpressionType::MemberAccess:
+		case ExpressionType::PointerMemberAccess:
+			fold(exp.a);
+			break;
+		case ExpressionType::VariableRef: {
+			folded_variable* var = find_variable(exp.a);
+			if (var) var->reads.push_back(e);
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	void declare(node_index l, node_index definition) {
+		const Line& line = app.lines[l];
+		fold(line.a);
+		folded_variable& var = variables[l];
+		var.type = app.types[line.c];
+		var.definition = definition;
+		if (line.a == NO_NODE) var.known = definition == NO_NODE; // 0 until it's assigned
+		else var.known = constant(line.a, var.value);
+		var.value = wrap(var.value, var.type);
+		scope.push_back({ line.b, l });
+	}
+
+	// the assignment to the variable declared by l if the next line is one
+	node_index definition_after(node_index l, node_index next) {
+		const Line& line = app.lines[l];
+		const Line& after = app.lines[next];
+		if (line.a != NO_NODE || after.type != LineType::Expression || after.a == NO_NODE) return NO_NODE;
+		const Expression& exp = app.expressions[after.a];
+		if (exp.type != ExpressionType::BinaryOperator || exp.op != assignment) return NO_NODE;
+		const Expression& target = app.expressions[exp.a];
+		if (target.type != ExpressionType::VariableRef || target.a != line.b) return NO_NODE;
+		return after.a;
+	}
+
+	void fold_line(node_index l) {
+		if (l == NO_NODE) return;
+		const Line line = app.lines[l];
+		size_t scope_size = scope.size();
+		switch (line.type) {
+		case LineType::Return:
+		case LineType::Expression:
+			fold(line.a);
+			break;
+		case LineType::VariableDeclaration:
+			declare(l, NO_NODE);
+			return; // stays in scope until the end of the enclosing block
+		case LineType::If:
+			fold(line.a);
+			fold_line(line.b);
+			fold_line(line.c);
+			break;
+		case LineType::Block:
+			for (node_index i = 0; i < line.b; i++) {
+				node_index child = app.children[line.a + i];
+				if (app.lines[child].type == LineType::VariableDeclaration && i + 1 < line.b) {
+					declare(child, definition_after(child, app.children[line.a + i + 1]));
+				}
+				else fold_line(child);
+			}
+			break;
+		case LineType::For:
+			fold_line(line.a);
+			fold(line.b);
+			fold(app.children[line.c]);
+			fold_line(app.children[line.c + 1]);
+			break;
+		case LineType::While:
+		case LineType::DoWhile:
+			fold(line.a);
+			fold_line(line.b);
+			break;
+		default:
+			break;
+		}
+		scope.resize(scope_size);
+	}
+
+	// one pass over the function, true if a variable was replaced and another pass may fold more
+	bool fold_pass(const Function& function) {
+		scope.clear();
+		variables.clear();
+		for (const auto& param : function.params) scope.push_back({ param.first, NO_NODE });
+		fold_line(function.lines);
+		bool replaced = false;
+		for (auto& v : variables) {
+			const folded_variable& var = v.second;
+			if (var.modified || !var.known || !is_integer(var.type)) continue;
+			for (node_index e : var.reads) set_constant(e, var.value, var.type);
+			replaced |= !var.reads.empty();
+		}
+		return replaced;
+	}
+
+	void fold_application() {
+		for (const Function& function : app.functions) {
+			if (function.lines == NO_NODE) continue;
+			while (fold_pass(function)) {
+			}
+		}
+	}
+};
+
+void Application::fold_constants() {
+	constant_folding folding(*this);
+	folding.fold_application();
+}
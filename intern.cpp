@@ -0,0 +1,20 @@
+#include "intern.h"
+
+interner symbols;
+
+symbol interner::intern(std::string_view name) {
+	auto it = ids.find(name);
+	if (it != ids.end()) return it->second;
+	symbol s = (symbol)names.size();
+	names.emplace_back(name);
+	ids.emplace(names.back(), s);
+	return s;
+}
+
+symbol intern(std::string_view name) {
+	return symbols.intern(name);
+}
+
+const std::string& symbol_name(symbol s) {
+	return symbols.name(s);
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// identifiers are interned once when they are lexed and referred to by a dense id
+// afterwards, so symbol tables compare integers instead of strings
+typedef int symbol;
+
+const symbol NO_SYMBOL = -1;
+
+// ids are handed out in order of first appearance
+class interner {
+public:
+	symbol intern(std::string_view name);
+	const std::string& name(symbol s) const {
+		return names[s];
+	}
+	size_t size() const {
+		return names.size();
+	}
+
+private:
+	// a deque never moves its elements, so the keys can view the stored names directly
+	std::deque<std::string> names;
+	std::unordered_map<std::string_view, symbol> ids;
+};
+
+// the compiler's global symbol table
+symbol intern(std::string_view name);
+const std::string& symbol_name(symbol s);
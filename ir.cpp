@@ -0,0 +1,1002 @@
+#include "ir.h"
+#include <algorithm>
+#include <charconv>
+#include <exception>
+
+ir_value ir_function::add(unsigned int block, IrInstr in) {
+	in.block = block;
+	instrs.push_back(std::move(in));
+	ir_value v = (ir_value)instrs.size() - 1;
+	blocks[block].code.push_back(v);
+	return v;
+}
+
+ir_value ir_function::insert(unsigned int block, size_t position, IrInstr in) {
+	in.block = block;
+	instrs.push_back(std::move(in));
+	ir_value v = (ir_value)instrs.size() - 1;
+	blocks[block].code.insert(blocks[block].code.begin() + position, v);
+	return v;
+}
+
+std::vector<unsigned int> ir_function::successors(unsigned int block) const {
+	const IrBlock& b = blocks[block];
+	if (b.code.empty()) return {};
+	const IrInstr& last = instrs[b.code.back()];
+	if (last.op == IrOp::Jmp) return { last.targets[0] };
+	if (last.op == IrOp::Br) return { last.targets[0], last.targets[1] };
+	return {};
+}
+
+void ir_function::replace_uses(ir_value from, ir_value to) {
+	for (IrInstr& in : instrs) {
+		if (in.a == from) in.a = to;
+		if (in.b == from) in.b = to;
+		for (ir_value& arg : in.args) {
+			if (arg == from) arg = to;
+		}
+	}
+}
+
+// blocks in reverse postorder from the entry, which puts every block after its dominator
+std::vector<unsigned int> reverse_postorder(const ir_function& f) {
+	std::vector<unsigned int> order;
+	std::vector<bool> visited(f.blocks.size());
+	// an explicit stack of blocks and how many of their successors have been visited
+	std::vector<std::pair<unsigned int, size_t>> stack = { { 0, 0 } };
+	visited[0] = true;
+	while (!stack.empty()) {
+		auto& top = stack.back();
+		std::vector<unsigned int> next = f.successors(top.first);
+		if (top.second < next.size()) {
+			unsigned int s = next[top.second++];
+			if (!visited[s]) {
+				visited[s] = true;
+				stack.push_back({ s, 0 });
+			}
+			continue;
+		}
+		order.push_back(top.first);
+		stack.pop_back();
+	}
+	std::reverse(order.begin(), order.end());
+	return order;
+}
+
+// the immediate dominator of every reachable block, after Cooper, Harvey and Kennedy.
+// unreachable blocks get -1 and the entry itself
+std::vector<int> immediate_dominators(const ir_function& f) {
+	std::vector<unsigned int> order = reverse_postorder(f);
+	std::vector<int> position(f.blocks.size(), -1), idom(f.blocks.size(), -1);
+	for (size_t i = 0; i < order.size(); i++) position[order[i]] = (int)i;
+	idom[0] = 0;
+	auto intersect = [&](int a, int b) {
+		while (a != b) {
+			while (position[a] > position[b]) a = idom[a];
+			while (position[b] > position[a]) b = idom[b];
+		}
+		return a;
+	};
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (size_t i = 1; i < order.size(); i++) {
+			unsigned int b = order[i];
+			int dom = -1;
+			for (unsigned int p : f.blocks[b].predecessors) {
+				if (idom[p] < 0) continue;
+				dom = dom < 0 ? (int)p : intersect((int)p, dom);
+			}
+			if (dom != idom[b]) {
+				idom[b] = dom;
+				changed = true;
+			}
+		}
+	}
+	return idom;
+}
+
+void verify(const ir_function& f) {
+	if (f.blocks.empty()) throw std::exception("IR function has no blocks");
+	std::vector<std::vector<unsigned int>> predecessors(f.blocks.size());
+	for (unsigned int b = 0; b < f.blocks.size(); b++) {
+		const IrBlock& bl = f.blocks[b];
+		if (bl.code.empty() || !is_terminator(f.instrs[bl.code.back()].op)) throw std::exception("IR block doesn't end in a terminator");
+		bool phis = true;
+		for (size_t i = 0; i < bl.code.size(); i++) {
+			const IrInstr& in = f.instrs[bl.code[i]];
+			if (in.block != b || in.removed) throw std::exception("IR block holds an instruction of another block");
+			if (is_terminator(in.op) && i + 1 != bl.code.size()) throw std::exception("IR terminator in the middle of a block");
+			if (in.op == IrOp::Phi && !phis) throw std::exception("IR phi after other instructions");
+			if (in.op == IrOp::Phi && in.args.size() != bl.predecessors.size()) throw std::exception("IR phi doesn't have an argument for every predecessor");
+			phis = phis && in.op == IrOp::Phi;
+		}
+		for (unsigned int s : f.successors(b)) {
+			if (s >= f.blocks.size()) throw std::exception("IR jump to a block that doesn't exist");
+			predecessors[s].push_back(b);
+		}
+	}
+	for (unsigned int b = 0; b < f.blocks.size(); b++) {
+		std::vector<unsigned int> listed = f.blocks[b].predecessors;
+		std::sort(listed.begin(), listed.end());
+		std::sort(predecessors[b].begin(), predecessors[b].end());
+		if (listed != predecessors[b]) throw std::exception("IR predecessors don't match the jumps");
+	}
+
+	std::vector<int> idom = immediate_dominators(f);
+	std::vector<int> index(f.instrs.size(), -1); // of each instruction in its block
+	for (const IrBlock& bl : f.blocks) {
+		for (size_t i = 0; i < bl.code.size(); i++) index[bl.code[i]] = (int)i;
+	}
+	auto dominates = [&](unsigned int a, unsigned int b) {
+		if (idom[b] < 0) return true; // nothing is wrong in code that never runs
+		for (;;) {
+			if (a == b) return true;
+			if (b == 0) return false;
+			b = (unsigned int)idom[b];
+		}
+	};
+	// whether value v is defined at instruction position i of block b
+	auto available = [&](ir_value v, unsigned int b, int i) {
+		if (v == NO_VALUE || v >= f.instrs.size() || index[v] < 0 || !has_result(f.instrs[v].op)) return false;
+		unsigned int d = f.instrs[v].block;
+		if (d == b) return index[v] < i;
+		return dominates(d, b);
+	};
+	auto width = [&](ir_value v) { return f.instrs[v].type; };
+
+	for (unsigned int b = 0; b < f.blocks.size(); b++) {
+		const IrBlock& bl = f.blocks[b];
+		for (int i = 0; i < (int)bl.code.size(); i++) {
+			const IrInstr& in = f.instrs[bl.code[i]];
+			if (in.op == IrOp::Phi) {
+				for (size_t p = 0; p < in.args.size(); p++) {
+					unsigned int pred = bl.predecessors[p];
+					if (!available(in.args[p], pred, (int)f.blocks[pred].code.size())) throw std::exception("IR phi argument isn't defined on its edge");
+					if (width(in.args[p]) != in.type) throw std::exception("IR phi argument has the wrong width");
+				}
+				continue;
+			}
+			bool uses_a = (in.op >= IrOp::Add && in.op <= IrOp::Store) || in.op == IrOp::VecMap || in.op == IrOp::VecSum || in.op == IrOp::Br
+				|| ((in.op == IrOp::Call || in.op == IrOp::Ret) && in.a != NO_VALUE);
+			bool uses_b = (in.op >= IrOp::Add && in.op <= IrOp::Shr) || (in.op >= IrOp::Eq && in.op <= IrOp::Ge) || in.op == IrOp::Store || in.op == IrOp::VecSum;
+			if (uses_a && !available(in.a, b, i)) throw std::exception("IR value used where it isn't defined");
+			if (uses_b && !available(in.b, b, i)) throw std::exception("IR value used where it isn't defined");
+			for (ir_value arg : in.args) {
+				if (!available(arg, b, i)) throw std::exception("IR value used where it isn't defined");
+			}
+			switch (in.op) {
+			case IrOp::Add: case IrOp::Sub: case IrOp::Mul: case IrOp::Div: case IrOp::Mod:
+			case IrOp::And: case IrOp::Or: case IrOp::Xor: case IrOp::Shl: case IrOp::Shr:
+				if (width(in.a) != in.type || width(in.b) != in.type) throw std::exception("IR operands have the wrong width");
+				break;
+			case IrOp::Neg: case IrOp::Not:
+				if (width(in.a) != in.type) throw std::exception("IR operand has the wrong width");
+				break;
+			case IrOp::Eq: case IrOp::Ne: case IrOp::Lt: case IrOp::Gt: case IrOp::Le: case IrOp::Ge:
+				if (width(in.a) != width(in.b) || in.type != i32) throw std::exception("IR comparison has the wrong widths");
+				break;
+			case IrOp::Sext:
+				if (width(in.a) >= in.type) throw std::exception("IR sign extension doesn't widen");
+				break;
+			case IrOp::Trunc:
+				if (width(in.a) <= in.type) throw std::exception("IR truncation doesn't narrow");
+				break;
+			case IrOp::Load: case IrOp::Store:
+				if (width(in.a) != i64) throw std::exception("IR address isn't 64 bit");
+				break;
+			case IrOp::Call:
+				if (in.name == NO_SYMBOL && (in.a == NO_VALUE || width(in.a) != i64)) throw std::exception("IR call has no target");
+				break;
+			case IrOp::VecMap:
+				if (in.type != i64 || width(in.a) != i64 || in.args.size() != 3) throw std::exception("IR vector operation has the wrong operands");
+				for (ir_value arg : in.args) {
+					if (width(arg) != i64) throw std::exception("IR address isn't 64 bit");
+				}
+				break;
+			case IrOp::VecSum:
+				if (in.type != in.element || width(in.a) != i64 || width(in.b) != i64) throw std::exception("IR vector operation has the wrong operands");
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+#define IR_NAME(name) #name,
+
+const char* ir_names[] = {
+	IR_OPS(IR_NAME)
+};
+
+const char* width_names[] = { "i8", "i16", "i32", "i64" };
+
+inline void append_number(output_buffer& out, long long value) {
+	char buffer[24];
+	out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr - buffer);
+}
+
+inline void append_value(output_buffer& out, ir_value v) {
+	out.append('%');
+	append_number(out, v);
+}
+
+inline void append_block(output_buffer& out, unsigned int b) {
+	out.append('b');
+	append_number(out, b);
+}
+
+void dump(const ir_function& f, output_buffer& out) {
+	out.append("function ");
+	out.append(symbol_name(f.name));
+	out.append('\n');
+	for (unsigned int b = 0; b < f.blocks.size(); b++) {
+		const IrBlock& bl = f.blocks[b];
+		append_block(out, b);
+		out.append(':');
+		if (!bl.predecessors.empty()) {
+			out.append(" ; from");
+			for (unsigned int p : bl.predecessors) {
+				out.append(' ');
+				append_block(out, p);
+			}
+		}
+		out.append('\n');
+		for (ir_value v : bl.code) {
+			const IrInstr& in = f.instrs[v];
+			out.append('\t');
+			if (has_result(in.op)) {
+				append_value(out, v);
+				out.append(" = ");
+			}
+			for (const char* c = ir_names[(int)in.op]; *c; c++) out.append((char)(*c | 0x20));
+			if (has_result(in.op)) {
+				out.append('.');
+				out.append(width_names[in.type]);
+			}
+			bool first = true;
+			auto separate = [&]() {
+				out.append(first ? " " : ", ");
+				first = false;
+			};
+			switch (in.op) {
+			case IrOp::Const:
+			case IrOp::Param:
+			case IrOp::Alloca:
+				separate();
+				append_number(out, in.constant);
+				break;
+			case IrOp::Symbol:
+				separate();
+				out.append(symbol_name(in.name));
+				break;
+			case IrOp::Load:
+			case IrOp::Store:
+				separate();
+				append_value(out, in.a);
+				if (in.constant) {
+					out.append('+');
+					append_number(out, in.constant);
+				}
+				if (in.op == IrOp::Store) {
+					separate();
+					append_value(out, in.b);
+				}
+				break;
+			case IrOp::Call:
+				separate();
+				if (in.name != NO_SYMBOL) out.append(symbol_name(in.name));
+				else append_value(out, in.a);
+				for (ir_value arg : in.args) {
+					separate();
+					append_value(out, arg);
+				}
+				break;
+			case IrOp::VecMap:
+				separate();
+				for (const char* c = ir_names[in.constant]; *c; c++) out.append((char)(*c | 0x20));
+				out.append('.');
+				out.append(width_names[in.element]);
+				separate();
+				append_value(out, in.a);
+				for (ir_value arg : in.args) {
+					separate();
+					append_value(out, arg);
+				}
+				break;
+			case IrOp::Phi:
+				for (size_t i = 0; i < in.args.size(); i++) {
+					separate();
+					out.append('[');
+					append_block(out, bl.predecessors[i]);
+					out.append(": ");
+					append_value(out, in.args[i]);
+					out.append(']');
+				}
+				break;
+			case IrOp::Jmp:
+				separate();
+				append_block(out, in.targets[0]);
+				break;
+			case IrOp::Br:
+				separate();
+				append_value(out, in.a);
+				separate();
+				append_block(out, in.targets[0]);
+				separate();
+				append_block(out, in.targets[1]);
+				break;
+			default:
+				if (in.a != NO_VALUE) {
+					separate();
+					append_value(out, in.a);
+				}
+				if (in.b != NO_VALUE) {
+					separate();
+					append_value(out, in.b);
+				}
+				break;
+			}
+			out.append('\n');
+		}
+	}
+}
+
+void remove_trivial_phis(ir_function& f) {
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (IrBlock& bl : f.blocks) {
+			for (size_t i = 0; i < bl.code.size() && f.instrs[bl.code[i]].op == IrOp::Phi;) {
+				ir_value phi = bl.code[i];
+				ir_value same = NO_VALUE;
+				bool trivial = true;
+				for (ir_value arg : f.instrs[phi].args) {
+					if (arg == phi || arg == same) continue;
+					if (same != NO_VALUE) trivial = false;
+					same = arg;
+				}
+				if (!trivial || same == NO_VALUE) {
+					i++;
+					continue;
+				}
+				f.instrs[phi].removed = true;
+				f.instrs[phi].args.clear();
+				bl.code.erase(bl.code.begin() + i);
+				f.replace_uses(phi, same);
+				changed = true;
+			}
+		}
+	}
+}
+
+void remove_unreachable_blocks(ir_function& f) {
+	std::vector<unsigned int> order = reverse_postorder(f);
+	if (order.size() == f.blocks.size()) return;
+	std::vector<int> number(f.blocks.size(), -1);
+	// reachable blocks keep their order, so the code reads the way the source does
+	std::sort(order.begin(), order.end());
+	for (size_t i = 0; i < order.size(); i++) number[order[i]] = (int)i;
+
+	std::vector<IrBlock> blocks;
+	for (unsigned int b : order) {
+		IrBlock bl = std::move(f.blocks[b]);
+		// phis lose the arguments of edges from blocks that go away
+		std::vector<unsigned int> predecessors;
+		std::vector<bool> keep;
+		for (unsigned int p : bl.predecessors) {
+			keep.push_back(number[p] >= 0);
+			if (number[p] >= 0) predecessors.push_back((unsigned int)number[p]);
+		}
+		for (ir_value v : bl.code) {
+			IrInstr& in = f.instrs[v];
+			in.block = (unsigned int)number[b];
+			for (unsigned int& t : in.targets) t = number[t] >= 0 ? (unsigned int)number[t] : 0;
+			if (in.op != IrOp::Phi) continue;
+			std::vector<ir_value> args;
+			for (size_t i = 0; i < in.args.size(); i++) {
+				if (keep[i]) args.push_back(in.args[i]);
+			}
+			in.args = std::move(args);
+		}
+		bl.predecessors = std::move(predecessors);
+		blocks.push_back(std::move(bl));
+	}
+	for (size_t b = 0; b < f.blocks.size(); b++) {
+		if (number[b] >= 0) continue;
+		for (ir_value v : f.blocks[b].code) {
+			f.instrs[v].removed = true;
+			f.instrs[v].args.clear();
+		}
+	}
+	f.blocks = std::move(blocks);
+}
+
+// operations that only compute their result from their operands, so running them where the
+// operands are defined instead of where they were written changes nothing. division isn't
+// one: it traps on 0, which a loop that never divides must not start doing
+inline bool is_pure(IrOp op) {
+	switch (op) {
+	case IrOp::Add: case IrOp::Sub: case IrOp::Mul: case IrOp::And: case IrOp::Or: case IrOp::Xor: case IrOp::Shl: case IrOp::Shr:
+	case IrOp::Neg: case IrOp::Not: case IrOp::Eq: case IrOp::Ne: case IrOp::Lt: case IrOp::Gt: case IrOp::Le: case IrOp::Ge:
+	case IrOp::Sext: case IrOp::Trunc:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// a natural loop, the blocks that reach a back edge to the header without going through it
+struct ir_loop {
+	unsigned int header = 0;
+	std::vector<bool> blocks;
+	int preheader = -1; // the one block outside the loop that enters it, if it goes nowhere else
+};
+
+// the loops of f, inner loops before the loops around them
+std::vector<ir_loop> find_loops(const ir_function& f) {
+	std::vector<int> idom = immediate_dominators(f);
+	auto dominates = [&](unsigned int a, unsigned int b) {
+		if (idom[b] < 0) return false;
+		for (;;) {
+			if (a == b) return true;
+			if (b == 0) return false;
+			b = (unsigned int)idom[b];
+		}
+	};
+	std::vector<ir_loop> loops;
+	for (unsigned int b = 0; b < f.blocks.size(); b++) {
+		for (unsigned int h : f.successors(b)) {
+			if (!dominates(h, b)) continue;
+			size_t l = 0;
+			while (l < loops.size() && loops[l].header != h) l++;
+			if (l == loops.size()) {
+				loops.emplace_back();
+				loops[l].header = h;
+				loops[l].blocks.assign(f.blocks.size(), false);
+				loops[l].blocks[h] = true;
+			}
+			std::vector<bool>& in_loop = loops[l].blocks;
+			std::vector<unsigned int> work;
+			if (!in_loop[b]) work.push_back(b);
+			while (!work.empty()) {
+				unsigned int x = work.back();
+				work.pop_back();
+				if (in_loop[x]) continue;
+				in_loop[x] = true;
+				for (unsigned int p : f.blocks[x].predecessors) {
+					if (!in_loop[p]) work.push_back(p);
+				}
+			}
+		}
+	}
+	for (ir_loop& loop : loops) {
+		for (unsigned int p : f.blocks[loop.header].predecessors) {
+			if (loop.blocks[p]) continue;
+			loop.preheader = loop.preheader == -1 ? (int)p : -2;
+		}
+		if (loop.preheader < 0 || f.successors((unsigned int)loop.preheader).size() != 1) loop.preheader = -1;
+	}
+	// an inner loop has fewer blocks than any loop around it
+	std::stable_sort(loops.begin(), loops.end(), [](const ir_loop& a, const ir_loop& b) {
+		return std::count(a.blocks.begin(), a.blocks.end(), true) < std::count(b.blocks.begin(), b.blocks.end(), true);
+	});
+	return loops;
+}
+
+// the position in the preheader of a loop where new code goes, before its terminator
+inline size_t preheader_end(const ir_function& f, const ir_loop& loop) {
+	return f.blocks[loop.preheader].code.size() - 1;
+}
+
+void hoist_loop_invariants(ir_function& f) {
+	std::vector<unsigned int> order = reverse_postorder(f);
+	for (const ir_loop& loop : find_loops(f)) {
+		if (loop.preheader < 0) continue;
+		unsigned int ph = (unsigned int)loop.preheader;
+		auto invariant = [&](ir_value v) {
+			return v == NO_VALUE || !loop.blocks[f.instrs[v].block] || f.instrs[v].op == IrOp::Const;
+		};
+		// a constant in the loop stays for its other uses there, and a copy of it goes along
+		auto outside = [&](ir_value o) {
+			if (o == NO_VALUE || !loop.blocks[f.instrs[o].block]) return o;
+			IrInstr copy = f.instrs[o];
+			return f.insert(ph, preheader_end(f, loop), copy);
+		};
+		// in reverse postorder an instruction's operands are seen before it, except through phis
+		for (unsigned int b : order) {
+			if (!loop.blocks[b]) continue;
+			std::vector<ir_value> code = f.blocks[b].code;
+			for (ir_value v : code) {
+				if (!is_pure(f.instrs[v].op) || !invariant(f.instrs[v].a) || !invariant(f.instrs[v].b)) continue;
+				ir_value left = outside(f.instrs[v].a);
+				ir_value right = outside(f.instrs[v].b);
+				f.instrs[v].a = left;
+				f.instrs[v].b = right;
+				std::vector<ir_value>& from = f.blocks[b].code;
+				from.erase(std::find(from.begin(), from.end(), v));
+				std::vector<ir_value>& to = f.blocks[ph].code;
+				to.insert(to.end() - 1, v);
+				f.instrs[v].block = ph;
+			}
+		}
+	}
+}
+
+// a loop of one or two blocks counting i up by 1 to a limit that maps two arrays onto a third
+// or adds up one, element by element
+struct vector_loop {
+	unsigned int latch = 0; // the block that ends in the test
+	unsigned int exit = 0;
+	ir_value i = NO_VALUE, next = NO_VALUE, init = NO_VALUE, limit = NO_VALUE;
+	ir_value sum = NO_VALUE, sum_next = NO_VALUE, sum_init = NO_VALUE; // if it adds up
+	IrOp op = IrOp::Add;
+	size element = i64;
+	ir_value bases[3] = {}; // the arrays written and read on the left and right, or the one added up
+	std::vector<bool> explained; // the instructions that are part of the pattern
+};
+
+bool match_vector_loop(const ir_function& f, const ir_loop& loop, vector_loop& m) {
+	unsigned int h = loop.header, ph = (unsigned int)loop.preheader;
+	const IrBlock& header = f.blocks[h];
+	std::vector<unsigned int> blocks;
+	for (unsigned int b = 0; b < f.blocks.size(); b++) {
+		if (loop.blocks[b]) blocks.push_back(b);
+	}
+	if (blocks.size() > 2 || header.predecessors.size() != 2) return false;
+	m.latch = blocks.size() == 2 ? blocks[0] + blocks[1] - h : h;
+	if (m.latch != h && (f.instrs[header.code.back()].op != IrOp::Jmp || f.blocks[m.latch].predecessors.size() != 1)) return false;
+	const IrInstr& branch = f.instrs[f.blocks[m.latch].code.back()];
+	if (branch.op != IrOp::Br || branch.targets[0] != h || loop.blocks[branch.targets[1]]) return false;
+	m.exit = branch.targets[1];
+	const IrInstr& test = f.instrs[branch.a];
+	if (test.op != IrOp::Lt) return false;
+	m.next = test.a;
+	m.limit = test.b;
+	auto invariant = [&](ir_value v) {
+		return !loop.blocks[f.instrs[v].block];
+	};
+	// the same value, or constants that are equal
+	auto same = [&](ir_value a, ir_value b) {
+		const IrInstr& x = f.instrs[a];
+		const IrInstr& y = f.instrs[b];
+		return a == b || (x.op == IrOp::Const && y.op == IrOp::Const && x.type == y.type && x.constant == y.constant);
+	};
+	// a literal limit is a constant that hoisting copied out of the loop rather than moved
+	if (!invariant(m.limit) && f.instrs[m.limit].op != IrOp::Const) return false;
+
+	size_t from_preheader = header.predecessors[0] == ph ? 0 : 1;
+	for (ir_value v : header.code) {
+		const IrInstr& phi = f.instrs[v];
+		if (phi.op != IrOp::Phi) break;
+		ir_value around = phi.args[1 - from_preheader];
+		const IrInstr& step = f.instrs[around];
+		if (around == m.next && step.op == IrOp::Add && step.a == v && f.instrs[step.b].op == IrOp::Const && f.instrs[step.b].constant == 1
+			&& (phi.type == i32 || phi.type == i64)) {
+			m.i = v;
+			m.init = phi.args[from_preheader];
+		}
+		else if (m.sum == NO_VALUE) {
+			m.sum = v;
+			m.sum_next = around;
+			m.sum_init = phi.args[from_preheader];
+		}
+		else return false;
+	}
+	if (m.i == NO_VALUE) return false;
+	size s = f.instrs[m.i].type;
+
+	// the way in tests i's first value against the same limit, so the loop runs at least once
+	const IrBlock& before = f.blocks[ph];
+	if (before.predecessors.size() != 1) return false;
+	const IrInstr& guard = f.instrs[f.blocks[before.predecessors[0]].code.back()];
+	if (guard.op != IrOp::Br || guard.targets[0] != ph || guard.targets[1] != m.exit) return false;
+	const IrInstr& entry = f.instrs[guard.a];
+	if (entry.op != IrOp::Lt || !same(entry.b, m.limit) || !same(entry.a, m.init)) return false;
+	// the guard's limit is defined before the loop, so the preheader can use it
+	m.limit = entry.b;
+
+	m.explained.assign(f.instrs.size(), false);
+	auto explain = [&](ir_value v) {
+		m.explained[v] = true;
+	};
+	explain(m.i);
+	explain(m.next);
+	explain(branch.a);
+	// base + i * the bytes of width e, base, where base is the same on every trip
+	auto element_base = [&](ir_value address, size e) {
+		const IrInstr& add = f.instrs[address];
+		if (add.op != IrOp::Add || add.type != i64 || !invariant(add.a)) return NO_VALUE;
+		ir_value index = add.b;
+		if (e != i8) {
+			const IrInstr& scale = f.instrs[index];
+			if (scale.op != IrOp::Mul || f.instrs[scale.b].op != IrOp::Const || f.instrs[scale.b].constant != _bytes(e)) return NO_VALUE;
+			explain(index);
+			index = scale.a;
+		}
+		if (s == i32) {
+			if (f.instrs[index].op != IrOp::Sext || f.instrs[index].type != i64) return NO_VALUE;
+			explain(index);
+			index = f.instrs[index].a;
+		}
+		if (index != m.i) return NO_VALUE;
+		explain(address);
+		return add.a;
+	};
+	// the base of the element a load of width e in the loop reads
+	auto element_load = [&](ir_value v, size e) {
+		const IrInstr& load = f.instrs[v];
+		if (load.op != IrOp::Load || load.type != e || load.constant != 0 || !loop.blocks[load.block]) return NO_VALUE;
+		explain(v);
+		return element_base(load.a, e);
+	};
+	// what's cut down to width e by v, or v itself if it has that width
+	auto narrowed = [&](ir_value v, size e) {
+		if (f.instrs[v].op == IrOp::Trunc && f.instrs[v].type == e) {
+			explain(v);
+			return f.instrs[v].a;
+		}
+		return f.instrs[v].type == e ? v : NO_VALUE;
+	};
+	// what of width e is sign extended to width wide by v, or v itself if it has width e
+	auto widened = [&](ir_value v, size e, size wide) {
+		if (wide == e) return f.instrs[v].type == e ? v : NO_VALUE;
+		if (f.instrs[v].op != IrOp::Sext || f.instrs[v].type != wide || f.instrs[f.instrs[v].a].type != e) return NO_VALUE;
+		explain(v);
+		return f.instrs[v].a;
+	};
+
+	ir_value store = NO_VALUE;
+	for (unsigned int b : blocks) {
+		for (ir_value v : f.blocks[b].code) {
+			if (f.instrs[v].op != IrOp::Store) continue;
+			if (store != NO_VALUE) return false;
+			store = v;
+		}
+	}
+	if (store != NO_VALUE) {
+		if (m.sum != NO_VALUE || f.instrs[store].constant != 0) return false;
+		explain(store);
+		m.element = f.instrs[f.instrs[store].b].type;
+		m.bases[0] = element_base(f.instrs[store].a, m.element);
+		ir_value value = narrowed(f.instrs[store].b, m.element);
+		if (value == NO_VALUE) return false;
+		const IrInstr& operation = f.instrs[value];
+		switch (operation.op) {
+		case IrOp::Add: case IrOp::Sub: case IrOp::And: case IrOp::Or: case IrOp::Xor:
+			break;
+		default:
+			return false;
+		}
+		explain(value);
+		m.op = operation.op;
+		ir_value left = widened(operation.a, m.element, operation.type);
+		ir_value right = widened(operation.b, m.element, operation.type);
+		if (left == NO_VALUE || right == NO_VALUE) return false;
+		m.bases[1] = element_load(left, m.element);
+		m.bases[2] = element_load(right, m.element);
+		if (m.bases[1] == NO_VALUE || m.bases[2] == NO_VALUE) return false;
+	}
+	else {
+		if (m.sum == NO_VALUE) return false;
+		explain(m.sum);
+		m.element = f.instrs[m.sum].type;
+		ir_value value = narrowed(m.sum_next, m.element);
+		if (value == NO_VALUE || f.instrs[value].op != IrOp::Add) return false;
+		explain(value);
+		ir_value left = widened(f.instrs[value].a, m.element, f.instrs[value].type);
+		ir_value right = widened(f.instrs[value].b, m.element, f.instrs[value].type);
+		ir_value loaded = left == m.sum ? right : right == m.sum ? left : NO_VALUE;
+		if (loaded == NO_VALUE) return false;
+		m.bases[0] = element_load(loaded, m.element);
+	}
+	if (m.bases[0] == NO_VALUE) return false;
+
+	// nothing else goes on in the loop, and only i's and the sum's last values are used after it
+	for (unsigned int b : blocks) {
+		for (ir_value v : f.blocks[b].code) {
+			IrOp op = f.instrs[v].op;
+			if (op != IrOp::Const && !is_terminator(op) && !m.explained[v]) return false;
+		}
+	}
+	for (unsigned int b = 0; b < f.blocks.size(); b++) {
+		if (loop.blocks[b]) continue;
+		for (ir_value v : f.blocks[b].code) {
+			const IrInstr& in = f.instrs[v];
+			auto escapes = [&](ir_value u) {
+				if (u == NO_VALUE || !loop.blocks[f.instrs[u].block]) return false;
+				return in.op != IrOp::Phi || b != m.exit || (u != m.next && u != m.sum_next);
+			};
+			if (escapes(in.a) || escapes(in.b)) return false;
+			for (ir_value arg : in.args) {
+				if (escapes(arg)) return false;
+			}
+		}
+	}
+	return true;
+}
+
+void vectorize_loops(ir_function& f) {
+	for (const ir_loop& loop : find_loops(f)) {
+		if (loop.preheader < 0) continue;
+		vector_loop m;
+		if (!match_vector_loop(f, loop, m)) continue;
+		unsigned int ph = (unsigned int)loop.preheader;
+		size s = f.instrs[m.i].type;
+		auto add = [&](IrInstr in) {
+			return f.insert(ph, preheader_end(f, loop), in);
+		};
+		auto instr = [&](IrOp op, size type, ir_value a, ir_value b) {
+			IrInstr in;
+			in.op = op;
+			in.type = type;
+			in.a = a;
+			in.b = b;
+			return add(in);
+		};
+		auto constant = [&](long long value) {
+			IrInstr in;
+			in.constant = value;
+			return add(in);
+		};
+		auto wide = [&](ir_value v) {
+			return s == i64 ? v : instr(IrOp::Sext, i64, v, NO_VALUE);
+		};
+
+		// as many elements as fill whole chunks of 32 bytes, from where i starts
+		ir_value start = wide(m.init);
+		ir_value count = instr(IrOp::Sub, i64, wide(m.limit), start);
+		ir_value chunks = instr(IrOp::And, i64, count, constant(-(32 / _bytes(m.element))));
+		ir_value offset = m.element == i8 ? start : instr(IrOp::Mul, i64, start, constant(_bytes(m.element)));
+		IrInstr vector;
+		vector.element = m.element;
+		vector.a = chunks;
+		ir_value done = chunks, sum = NO_VALUE;
+		if (m.sum == NO_VALUE) {
+			vector.op = IrOp::VecMap;
+			vector.constant = (long long)m.op;
+			for (ir_value base : m.bases) vector.args.push_back(instr(IrOp::Add, i64, base, offset));
+			done = add(vector);
+		}
+		else {
+			vector.op = IrOp::VecSum;
+			vector.type = m.element;
+			vector.b = instr(IrOp::Add, i64, m.bases[0], offset);
+			ir_value partial = add(vector);
+			sum = instr(IrOp::Add, m.element, m.sum_init, partial);
+		}
+		ir_value resumed = instr(IrOp::Add, s, m.init, s == i64 ? done : instr(IrOp::Trunc, i32, done, NO_VALUE));
+		ir_value more = instr(IrOp::Lt, i32, resumed, m.limit);
+
+		// the loop picks up from there through a block of its own if anything's left, and the
+		// preheader goes straight to the exit otherwise
+		unsigned int rest = (unsigned int)f.blocks.size();
+		f.blocks.emplace_back();
+		f.blocks[rest].predecessors.push_back(ph);
+		IrInstr jump;
+		jump.op = IrOp::Jmp;
+		jump.targets[0] = loop.header;
+		f.add(rest, jump);
+		IrInstr& branch = f.instrs[f.blocks[ph].code.back()];
+		branch.op = IrOp::Br;
+		branch.a = more;
+		branch.targets[0] = rest;
+		branch.targets[1] = m.exit;
+		std::vector<unsigned int>& entries = f.blocks[loop.header].predecessors;
+		size_t from_preheader = std::find(entries.begin(), entries.end(), ph) - entries.begin();
+		entries[from_preheader] = rest;
+		f.instrs[m.i].args[from_preheader] = resumed;
+		if (m.sum != NO_VALUE) f.instrs[m.sum].args[from_preheader] = sum;
+		IrBlock& exit = f.blocks[m.exit];
+		size_t from_latch = std::find(exit.predecessors.begin(), exit.predecessors.end(), m.latch) - exit.predecessors.begin();
+		exit.predecessors.push_back(ph);
+		for (ir_value v : exit.code) {
+			IrInstr& phi = f.instrs[v];
+			if (phi.op != IrOp::Phi) break;
+			ir_value last = phi.args[from_latch];
+			phi.args.push_back(last == m.next ? resumed : last == m.sum_next ? sum : last);
+		}
+	}
+}
+
+// a pointer that steps through memory alongside an induction variable
+struct reduced_pointer {
+	ir_value base;
+	long long size;
+	ir_value phi, next;
+};
+
+void reduce_induction_variables(ir_function& f) {
+	for (const ir_loop& loop : find_loops(f)) {
+		if (loop.preheader < 0) continue;
+		unsigned int ph = (unsigned int)loop.preheader;
+		const IrBlock& header = f.blocks[loop.header];
+		auto invariant = [&](ir_value v) {
+			return v != NO_VALUE && !loop.blocks[f.instrs[v].block];
+		};
+		auto constant = [&](long long value) {
+			IrInstr in;
+			in.constant = value;
+			return in;
+		};
+		auto instr = [&](IrOp op, ir_value a, ir_value b) {
+			IrInstr in;
+			in.op = op;
+			in.a = a;
+			in.b = b;
+			return in;
+		};
+		std::vector<ir_value> phis;
+		for (ir_value v : header.code) {
+			if (f.instrs[v].op == IrOp::Phi) phis.push_back(v);
+		}
+		for (ir_value i : phis) {
+			// i starts at whatever it is on the way in and has step added by the time it goes around
+			size s = f.instrs[i].type;
+			if (s != i32 && s != i64) continue;
+			ir_value next = NO_VALUE;
+			bool simple = true;
+			for (size_t k = 0; k < header.predecessors.size(); k++) {
+				if (!loop.blocks[header.predecessors[k]]) continue;
+				if (next != NO_VALUE && f.instrs[i].args[k] != next) simple = false;
+				next = f.instrs[i].args[k];
+			}
+			if (!simple || next == NO_VALUE) continue;
+			const IrInstr& increment = f.instrs[next];
+			if ((increment.op != IrOp::Add && increment.op != IrOp::Sub) || increment.a != i || f.instrs[increment.b].op != IrOp::Const
+				|| !loop.blocks[increment.block]) continue;
+			long long step = s == i64 ? f.instrs[increment.b].constant : (int)f.instrs[increment.b].constant;
+			if (increment.op == IrOp::Sub) step = (long long)(0 - (unsigned long long)step);
+			ir_value init = f.instrs[i].args[std::find(header.predecessors.begin(), header.predecessors.end(), ph) - header.predecessors.begin()];
+
+			// base + value * size, for value i's start or a limit, added to the preheader
+			auto address_in_preheader = [&](ir_value base, ir_value value, long long size) {
+				if (f.instrs[value].op == IrOp::Const) {
+					long long index = s == i64 ? f.instrs[value].constant : (int)f.instrs[value].constant;
+					if (index == 0) return base;
+					ir_value offset = f.insert(ph, preheader_end(f, loop), constant((long long)((unsigned long long)index * size)));
+					return f.insert(ph, preheader_end(f, loop), instr(IrOp::Add, base, offset));
+				}
+				ir_value index = value;
+				if (s == i32) {
+					index = f.insert(ph, preheader_end(f, loop), instr(IrOp::Sext, value, NO_VALUE));
+				}
+				if (size > 1) {
+					ir_value scale = f.insert(ph, preheader_end(f, loop), constant(size));
+					index = f.insert(ph, preheader_end(f, loop), instr(IrOp::Mul, index, scale));
+				}
+				return f.insert(ph, preheader_end(f, loop), instr(IrOp::Add, base, index));
+			};
+			// i as an index of 64 bits, times size
+			auto scaled_index = [&](ir_value index, long long& size) {
+				size = 1;
+				const IrInstr& in = f.instrs[index];
+				if (in.op == IrOp::Mul && in.type == i64 && f.instrs[in.b].op == IrOp::Const && f.instrs[in.b].constant > 0) {
+					size = f.instrs[in.b].constant;
+					index = in.a;
+				}
+				if (s == i64) return index == i;
+				return f.instrs[index].op == IrOp::Sext && f.instrs[index].type == i64 && f.instrs[index].a == i;
+			};
+
+			std::vector<reduced_pointer> pointers;
+			for (unsigned int b = 0; b < f.blocks.size(); b++) {
+				if (!loop.blocks[b]) continue;
+				std::vector<ir_value> code = f.blocks[b].code;
+				for (ir_value v : code) {
+					const IrInstr& in = f.instrs[v];
+					long long size;
+					if (in.op != IrOp::Add || in.type != i64 || !invariant(in.a) || !scaled_index(in.b, size)) continue;
+					ir_value base = in.a;
+					size_t p = 0;
+					while (p < pointers.size() && (pointers[p].base != base || pointers[p].size != size)) p++;
+					if (p == pointers.size()) {
+						reduced_pointer pointer = { base, size, NO_VALUE, NO_VALUE };
+						ir_value start = address_in_preheader(base, init, size);
+						IrInstr phi;
+						phi.op = IrOp::Phi;
+						pointer.phi = f.insert(loop.header, 0, phi);
+						// the pointer steps right where i does
+						unsigned int block = f.instrs[next].block;
+						std::vector<ir_value>& stepping = f.blocks[block].code;
+						size_t position = std::find(stepping.begin(), stepping.end(), next) - stepping.begin() + 1;
+						ir_value stride = f.insert(block, position, constant((long long)((unsigned long long)step * size)));
+						pointer.next = f.insert(block, position + 1, instr(IrOp::Add, pointer.phi, stride));
+						for (unsigned int pred : header.predecessors) {
+							f.instrs[pointer.phi].args.push_back(loop.blocks[pred] ? pointer.next : start);
+						}
+						pointers.push_back(pointer);
+					}
+					f.replace_uses(v, pointers[p].phi);
+				}
+			}
+			if (pointers.empty()) continue;
+
+			// comparisons of i against a limit become comparisons of the first pointer against
+			// where it is when i reaches the limit. the pointer moves the same way as i as long as
+			// i doesn't overflow, which C leaves undefined
+			const reduced_pointer& pointer = pointers[0];
+			for (unsigned int b = 0; b < f.blocks.size(); b++) {
+				if (!loop.blocks[b]) continue;
+				std::vector<ir_value> code = f.blocks[b].code;
+				for (ir_value v : code) {
+					IrOp op = f.instrs[v].op;
+					if (op < IrOp::Eq || op > IrOp::Ge) continue;
+					ir_value left = f.instrs[v].a, right = f.instrs[v].b;
+					bool counter_left = left == i || left == next;
+					ir_value counter = counter_left ? left : right, limit = counter_left ? right : left;
+					if ((counter != i && counter != next) || !invariant(limit) || f.instrs[limit].type != s) continue;
+					ir_value moved = counter == i ? pointer.phi : pointer.next;
+					ir_value end = address_in_preheader(pointer.base, limit, pointer.size);
+					f.instrs[v].a = counter_left ? moved : end;
+					f.instrs[v].b = counter_left ? end : moved;
+				}
+			}
+		}
+	}
+}
+
+// whether the instruction has to stay even if its result isn't used
+inline bool has_effect(IrOp op) {
+	return op == IrOp::Store || op == IrOp::Call || op == IrOp::VecMap || op == IrOp::Load || op == IrOp::VecSum || op == IrOp::Div || op == IrOp::Mod
+		|| is_terminator(op);
+}
+
+void remove_dead_code(ir_function& f) {
+	std::vector<bool> live(f.instrs.size(), false);
+	std::vector<ir_value> work;
+	for (const IrBlock& bl : f.blocks) {
+		for (ir_value v : bl.code) {
+			if (has_effect(f.instrs[v].op)) work.push_back(v);
+		}
+	}
+	while (!work.empty()) {
+		ir_value v = work.back();
+		work.pop_back();
+		if (v == NO_VALUE || live[v]) continue;
+		live[v] = true;
+		const IrInstr& in = f.instrs[v];
+		work.push_back(in.a);
+		work.push_back(in.b);
+		for (ir_value arg : in.args) work.push_back(arg);
+	}
+	for (IrBlock& bl : f.blocks) {
+		std::vector<ir_value> code;
+		for (ir_value v : bl.code) {
+			if (live[v]) code.push_back(v);
+			else {
+				f.instrs[v].removed = true;
+				f.instrs[v].args.clear();
+			}
+		}
+		bl.code = std::move(code);
+	}
+}
+
+void optimize(ir_function& f) {
+	hoist_loop_invariants(f);
+	vectorize_loops(f);
+	reduce_induction_variables(f);
+	remove_dead_code(f);
+}
+
+void split_critical_edges(ir_function& f) {
+	size_t count = f.blocks.size();
+	for (unsigned int b = 0; b < count; b++) {
+		if (f.instrs[f.blocks[b].code.back()].op != IrOp::Br) continue;
+		for (int t = 0; t < 2; t++) {
+			unsigned int s = f.instrs[f.blocks[b].code.back()].targets[t];
+			if (f.instrs[f.blocks[s].code.front()].op != IrOp::Phi) continue;
+			unsigned int edge = (unsigned int)f.blocks.size();
+			f.blocks.push_back(IrBlock());
+			f.blocks[edge].predecessors.push_back(b);
+			IrInstr jump;
+			jump.op = IrOp::Jmp;
+			jump.targets[0] = s;
+			f.add(edge, jump);
+			f.instrs[f.blocks[b].code.back()].targets[t] = edge;
+			// both targets can be the same block, so only the first matching edge moves
+			std::vector<unsigned int>& predecessors = f.blocks[s].predecessors;
+			*std::find(predecessors.begin(), predecessors.end(), b) = edge;
+		}
+	}
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <vector>
+#include "intern.h"
+#include "output.h"
+#include "register.h"
+
+struct assembly;
+
+// the middle end: each function is lowered from the tree to static single assignment form,
+// optimized, and handed to instruction selection. a function is self-contained, so the
+// passes over one never look at another.
+// every instruction that has a result is that value, named by its index in the function.
+// values are integers of one of the four widths, held in 64 bit registers of which only the
+// low bits of the width mean anything. variables whose address is never taken are values
+// joined by phis, everything else is memory reached through explicit loads and stores
+
+// type is the width of the result unless noted
+#define IR_OPS(X) \
+	X(Const)      /* constant */ \
+	X(Param)      /* parameter number constant, as it was passed */ \
+	X(Alloca)     /* the address of constant bytes in the frame */ \
+	X(Symbol)     /* the address of the function called name */ \
+	X(Add) X(Sub) X(Mul) X(Div) X(Mod) X(And) X(Or) X(Xor) X(Shl) X(Shr) /* a op b */ \
+	X(Neg) X(Not) /* op a */ \
+	X(Eq) X(Ne) X(Lt) X(Gt) X(Le) X(Ge) /* a op b at their own width, 1 or 0 as an i32 */ \
+	X(Sext)       /* a sign extended from its width */ \
+	X(Trunc)      /* the low bits of a */ \
+	X(Load)       /* the value at address a + constant */ \
+	X(Store)      /* b at its width to address a + constant, no result */ \
+	X(Call)       /* name, or the function at address a if there's no name, with args */ \
+	X(VecMap)     /* args[0][k] = args[1][k] op args[2][k] for the first a elements of width element, */ \
+	              /* with op the IrOp constant. a, or 0 if the arrays overlap and nothing was done */ \
+	X(VecSum)     /* the sum of the first a elements of width element from address b */ \
+	X(Phi)        /* args[i] when entered from predecessors[i] of the block */ \
+	X(Jmp)        /* to targets[0] */ \
+	X(Br)         /* to targets[0] if a isn't 0 and targets[1] if it is */ \
+	X(Ret)        /* a, or nothing if a is NO_VALUE */
+
+#define IR_ENUM(name) name,
+
+enum class IrOp : unsigned char {
+	IR_OPS(IR_ENUM)
+};
+
+typedef unsigned int ir_value;
+const ir_value NO_VALUE = 0;
+
+struct IrInstr {
+	IrOp op = IrOp::Const;
+	size type = i64;
+	unsigned int block = 0;
+	ir_value a = NO_VALUE, b = NO_VALUE;
+	long long constant = 0;
+	symbol name = NO_SYMBOL;
+	unsigned int targets[2] = {};
+	std::vector<ir_value> args;
+	size element = i64; // the width of the elements of a vector operation
+	bool removed = false; // dropped by a pass but still holding its number
+};
+
+struct IrBlock {
+	std::vector<ir_value> code; // phis first, a terminator last
+	std::vector<unsigned int> predecessors;
+};
+
+struct ir_function {
+	symbol name;
+	unsigned int params = 0;
+	std::vector<IrInstr> instrs; // instrs[0] is a placeholder so NO_VALUE is never an instruction
+	std::vector<IrBlock> blocks; // blocks[0] is the entry
+
+	ir_function() : instrs(1) {
+	}
+
+	// appends an instruction to the end of block
+	ir_value add(unsigned int block, IrInstr in);
+	// puts an instruction at position in block
+	ir_value insert(unsigned int block, size_t position, IrInstr in);
+	// the blocks a terminator jumps to
+	std::vector<unsigned int> successors(unsigned int block) const;
+	// points every use of from at to
+	void replace_uses(ir_value from, ir_value to);
+};
+
+inline bool is_terminator(IrOp op) {
+	return op >= IrOp::Jmp;
+}
+
+inline bool has_result(IrOp op) {
+	return op != IrOp::Store && !is_terminator(op);
+}
+
+// throws if blocks don't end in exactly one terminator, predecessor lists don't match the
+// jumps, phis don't have an argument for every predecessor, widths don't agree, or a value
+// is used where its definition doesn't dominate
+void verify(const ir_function& f);
+
+// one instruction per line, like "%3 = add.i32 %1, %2", under a label per block
+void dump(const ir_function& f, output_buffer& out);
+
+// drops phis that only ever merge one value and blocks that can't be reached
+void remove_trivial_phis(ir_function& f);
+void remove_unreachable_blocks(ir_function& f);
+
+// moves computations that give the same result on every trip around a loop into the block
+// before the loop, for loops entered from a single block that leads nowhere else
+void hoist_loop_invariants(ir_function& f);
+
+// turns innermost loops that add, subtract or combine bitwise two arrays into a third, or add
+// up an array, element by element, into a vector operation on as many elements as come in
+// whole 32 byte chunks, run before the loop. the loop carries on with the rest, and the whole
+// of it if the arrays overlap. only loops counting up by 1 to a limit and guarded by the same
+// test on the way in are done
+void vectorize_loops(ir_function& f);
+
+// replaces addresses base + i * size in a loop, where i steps by a constant on every trip and
+// base doesn't change, by a pointer that steps by the constant times size instead, and turns
+// comparisons of i against a limit into comparisons of the pointer, so i is often left unused
+void reduce_induction_variables(ir_function& f);
+
+// drops instructions whose results nothing with an effect depends on
+void remove_dead_code(ir_function& f);
+
+// the passes between lowering and instruction selection, in order
+void optimize(ir_function& f);
+
+// puts an empty block on every edge from a block with two successors to one with phis, so
+// the copies that leave SSA form have a place of their own
+void split_critical_edges(ir_function& f);
+
+// x86-64 code for f, written over virtual registers that allocate_registers() then maps onto
+// physical ones. splits f's critical edges first
+void select_instructions(ir_function& f, assembly& ass);
@@ -0,0 +1,593 @@
+#include "ast.h"
+#include "ir.h"
+#include "operators.h"
+#include "regalloc.h"
+#include <algorithm>
+
+// instruction selection from SSA form. value v of the function becomes virtual register v,
+// so registers past the last value are free for temporaries. arithmetic comes from the
+// operator tables at the width of the instruction, except multiplication and division by a
+// constant, which have cheaper sequences of their own. phis turn into copies at the end of
+// each predecessor, through temporaries so phis that read each other see the old values.
+// parameters arrive and calls pass arguments the Windows x64 way, or the System V way for
+// code that's linked on Linux. vector operations expand into loops of their own
+
+// the registers the first arguments go in, and where the rest go on the stack. Windows has
+// the caller leave a home slot on the stack for every argument, the first four included,
+// while System V only puts the arguments past the sixth there, and wants al to hold the
+// number of vector registers a variadic function is passed, which is always none here
+struct calling_convention {
+	reg registers[6];
+	int register_count;
+	bool home_slots;
+
+	// the offset from rsp at the call of argument i's slot on the stack, -1 if it has none
+	int slot(int i) const {
+		if (home_slots) return 8 * i;
+		return i < register_count ? -1 : 8 * (i - register_count);
+	}
+};
+
+const calling_convention windows_convention = { { rcx, rdx, r8, r9 }, 4, true };
+const calling_convention system_v_convention = { { rdi, rsi, rdx, rcx, r8, r9 }, 6, false };
+
+// the first label number of the function being selected, so labels are unique in a file
+int block_labels = 0;
+
+// k where value is 2 to the k, or -1
+inline int power_of_two(unsigned long long value) {
+	if (value == 0 || (value & (value - 1)) != 0) return -1;
+	int k = 0;
+	while (value >>= 1) k++;
+	return k;
+}
+
+// the multiplier and shift that divide by d at a width of bits, where d is neither 0 nor a
+// power of 2 either way round. the multiplier is signed at the width
+void division_magic(long long d, int bits, long long& multiplier, int& shift) {
+	unsigned long long mask = bits == 64 ? ~0ull : (1ull << bits) - 1;
+	unsigned long long two = 1ull << (bits - 1);
+	unsigned long long ad = (d < 0 ? 0 - (unsigned long long)d : (unsigned long long)d) & mask;
+	unsigned long long t = two + ((((unsigned long long)d) & mask) >> (bits - 1));
+	unsigned long long anc = t - 1 - t % ad;
+	int p = bits - 1;
+	unsigned long long q1 = two / anc, r1 = two - q1 * anc;
+	unsigned long long q2 = two / ad, r2 = two - q2 * ad;
+	unsigned long long delta;
+	do {
+		p++;
+		q1 = 2 * q1 & mask;
+		r1 = 2 * r1 & mask;
+		if (r1 >= anc) {
+			q1++;
+			r1 -= anc;
+		}
+		q2 = 2 * q2 & mask;
+		r2 = 2 * r2 & mask;
+		if (r2 >= ad) {
+			q2++;
+			r2 -= ad;
+		}
+		delta = ad - r2;
+	} while (q1 < delta || (q1 == delta && r1 == 0));
+	unsigned long long m = (q2 + 1) & mask;
+	if (d < 0) m = (0 - m) & mask;
+	multiplier = bits == 64 ? (long long)m : (long long)(int)(unsigned int)m;
+	shift = p - bits;
+}
+
+struct instruction_selection {
+	ir_function& f;
+	assembly& ass;
+	const calling_convention& convention;
+	unsigned int next_virtual = 0;
+	std::vector<int> slots; // frame offset of each Alloca, 0 for other values
+	std::vector<bool> fused; // comparisons only a branch right after them reads, done by the branch
+	int frame_size = 0;
+	int outgoing_size = 0;
+	int first_label = 0;
+
+	instruction_selection(ir_function& f, assembly& ass)
+		: f(f), ass(ass), convention(ass.system_v ? system_v_convention : windows_convention) {
+	}
+
+	MachineOperand reg(ir_value v, size s = i64) {
+		return virtual_operand(v, s);
+	}
+
+	MachineOperand width_of(ir_value v) {
+		return reg(v, f.instrs[v].type);
+	}
+
+	// a constant that fits straight into an instruction as an immediate, otherwise v's register
+	MachineOperand operand(ir_value v) {
+		const IrInstr& in = f.instrs[v];
+		bool fits = in.type == i8 ? in.constant == (signed char)in.constant : in.type == i16 ? in.constant == (short)in.constant : in.constant == (int)in.constant;
+		if (in.op == IrOp::Const && fits) return immediate_operand((int)in.constant);
+		return width_of(v);
+	}
+
+	MachineOperand temporary() {
+		return virtual_operand(next_virtual++);
+	}
+
+	MachineOperand label(unsigned int block) {
+		return label_operand(LabelType::Block, first_label + (int)block);
+	}
+
+	// the memory at address + displacement, straight off rbp for the frame
+	MachineOperand memory(ir_value address, long long displacement) {
+		if (f.instrs[address].op == IrOp::Alloca) return memory_operand(rbp, slots[address] + (int)displacement);
+		return virtual_memory_operand(address, (int)displacement);
+	}
+
+	static DataType type_of_width(size s) {
+		switch (s) {
+		case i8: return DataType::CHAR;
+		case i16: return DataType::SHORT;
+		case i32: return DataType::INT;
+		default: return DataType::LONG;
+		}
+	}
+
+	static binary_operator table_operator(IrOp op) {
+		switch (op) {
+		case IrOp::Add: return add;
+		case IrOp::Sub: return subtract;
+		case IrOp::Mul: return multiply;
+		case IrOp::Div: return divide;
+		case IrOp::Mod: return mod;
+		case IrOp::And: return bitwise_and;
+		case IrOp::Or: return bitwise_or;
+		case IrOp::Xor: return bitwise_xor;
+		case IrOp::Shl: return left_shift;
+		default: return right_shift;
+		}
+	}
+
+	static Opcode set_condition(IrOp op) {
+		switch (op) {
+		case IrOp::Eq: return Opcode::Sete;
+		case IrOp::Ne: return Opcode::Setne;
+		case IrOp::Lt: return Opcode::Setl;
+		case IrOp::Gt: return Opcode::Setg;
+		case IrOp::Le: return Opcode::Setle;
+		default: return Opcode::Setge;
+		}
+	}
+
+	static Opcode jump_condition(IrOp op, bool negate) {
+		switch (op) {
+		case IrOp::Eq: return negate ? Opcode::Jne : Opcode::Je;
+		case IrOp::Ne: return negate ? Opcode::Je : Opcode::Jne;
+		case IrOp::Lt: return negate ? Opcode::Jge : Opcode::Jl;
+		case IrOp::Gt: return negate ? Opcode::Jle : Opcode::Jg;
+		case IrOp::Le: return negate ? Opcode::Jg : Opcode::Jle;
+		default: return negate ? Opcode::Jl : Opcode::Jge;
+		}
+	}
+
+	// the copies for the phis of target on the edge from block
+	void phi_copies(unsigned int block, unsigned int target) {
+		const IrBlock& t = f.blocks[target];
+		size_t edge = std::find(t.predecessors.begin(), t.predecessors.end(), block) - t.predecessors.begin();
+		std::vector<std::pair<ir_value, MachineOperand>> copies;
+		for (ir_value v : t.code) {
+			const IrInstr& phi = f.instrs[v];
+			if (phi.op != IrOp::Phi) break;
+			MachineOperand temp = temporary();
+			ass.add(Opcode::Mov, i64, reg(phi.args[edge]), temp);
+			copies.push_back({ v, temp });
+		}
+		for (auto& copy : copies) ass.add(Opcode::Mov, i64, copy.second, reg(copy.first));
+	}
+
+	void load_constant(long long value, size s, const MachineOperand& dst) {
+		MachineOperand to = dst;
+		if (value != (int)value) {
+			// immediates are 32 bits and sign extended, so a wider constant is the high half
+			// shifted into place plus the low one, with the high half making up for the sign
+			unsigned long long low = (unsigned long long)(long long)(int)value;
+			int high = (int)(((unsigned long long)value - low) >> 32);
+			to.s = i64;
+			ass.add(Opcode::Mov, i64, immediate_operand(high), to);
+			ass.add(Opcode::Sal, i64, immediate_operand(32), to);
+			if ((int)value != 0) ass.add(Opcode::Add, i64, immediate_operand((int)value), to);
+			return;
+		}
+		to.s = s == i64 ? i64 : i32;
+		ass.add(Opcode::Mov, to.s, immediate_operand((int)value), to);
+	}
+
+	// whether v is a constant, and its value at width s
+	bool constant_of(ir_value v, size s, long long& value) {
+		const IrInstr& in = f.instrs[v];
+		if (in.op != IrOp::Const) return false;
+		value = s == i64 ? in.constant : (int)in.constant;
+		return true;
+	}
+
+	// x * c with a shift, and an add, subtract or negation, where that takes the place of an
+	// imul. false if c is a constant only imul does well, which is left to the table
+	bool select_multiply(ir_value v, ir_value x, long long c) {
+		size s = f.instrs[v].type;
+		if (s != i32 && s != i64) return false;
+		unsigned long long magnitude = c < 0 ? 0 - (unsigned long long)c : (unsigned long long)c;
+		MachineOperand result = reg(v, s);
+		if (c == 0) {
+			load_constant(0, s, reg(v));
+			return true;
+		}
+		int shift = power_of_two(magnitude);
+		Opcode adjust = Opcode::Mov;
+		if (shift < 0 && power_of_two(magnitude - 1) >= 0) {
+			shift = power_of_two(magnitude - 1);
+			adjust = Opcode::Add;
+		}
+		else if (shift < 0 && power_of_two(magnitude + 1) >= 0) {
+			shift = power_of_two(magnitude + 1);
+			adjust = Opcode::Sub;
+		}
+		if (shift < 0) {
+			if (c != (int)c) return false;
+			ass.add(Opcode::Mov, i64, reg(x), reg(v));
+			ass.add(Opcode::Imul, s, immediate_operand((int)c), result);
+			return true;
+		}
+		ass.add(Opcode::Mov, i64, reg(x), reg(v));
+		if (shift > 0) ass.add(Opcode::Sal, s, immediate_operand(shift), result);
+		if (adjust != Opcode::Mov) ass.add(adjust, s, reg(x, s), result);
+		if (c < 0) ass.add(Opcode::Neg, s, MachineOperand(), result);
+		return true;
+	}
+
+	// x / d or x % d without idiv: by a power of 2 as a shift, after adding d - 1 to negative x
+	// so the quotient rounds toward 0, and by anything else as a multiplication by a magic
+	// number that keeps the high half of the product, after Hacker's Delight 10-1. division by
+	// 0 is left to idiv, so it traps the same way
+	bool select_divide(ir_value v, ir_value x, long long d, bool remainder) {
+		size s = f.instrs[v].type;
+		if ((s != i32 && s != i64) || d == 0) return false;
+		int bits = s == i64 ? 64 : 32;
+		MachineOperand result = reg(v, s);
+		unsigned long long magnitude = d < 0 ? 0 - (unsigned long long)d : (unsigned long long)d;
+		if (magnitude == 1) {
+			if (remainder) load_constant(0, s, reg(v));
+			else {
+				ass.add(Opcode::Mov, i64, reg(x), reg(v));
+				if (d < 0) ass.add(Opcode::Neg, s, MachineOperand(), result);
+			}
+			return true;
+		}
+		MachineOperand wide = remainder ? temporary() : reg(v);
+		MachineOperand quotient = wide;
+		quotient.s = s;
+		int shift = power_of_two(magnitude);
+		if (shift > 0) {
+			ass.add(Opcode::Mov, i64, reg(x), wide);
+			ass.add(Opcode::Sar, s, immediate_operand(bits - 1), quotient);
+			ass.add(Opcode::Shr, s, immediate_operand(bits - shift), quotient);
+			ass.add(Opcode::Add, s, reg(x, s), quotient);
+			if (remainder) {
+				// x less the quotient times d, whose sign doesn't matter
+				if (shift < 32) ass.add(Opcode::And, s, immediate_operand((int)(0 - (1ull << shift))), quotient);
+				else {
+					ass.add(Opcode::Sar, s, immediate_operand(shift), quotient);
+					ass.add(Opcode::Sal, s, immediate_operand(shift), quotient);
+				}
+				ass.add(Opcode::Mov, i64, reg(x), reg(v));
+				ass.add(Opcode::Sub, s, quotient, result);
+				return true;
+			}
+			ass.add(Opcode::Sar, s, immediate_operand(shift), quotient);
+			if (d < 0) ass.add(Opcode::Neg, s, MachineOperand(), quotient);
+			return true;
+		}
+
+		long long multiplier;
+		division_magic(d, bits, multiplier, shift);
+		// the product is corrected by x when the multiplier's sign came out wrong
+		Opcode correction = d > 0 && multiplier < 0 ? Opcode::Add : d < 0 && multiplier > 0 ? Opcode::Sub : Opcode::Mov;
+		MachineOperand extended = reg(x);
+		if (s == i32) {
+			// an int times a 32 bit multiplier fits in 64 bits, so the high half is a shift away
+			extended = temporary();
+			ass.add(Opcode::Movsx, i32, reg(x, i32), extended);
+			ass.add(Opcode::Mov, i64, extended, wide);
+			ass.add(Opcode::Imul, i64, immediate_operand((int)multiplier), wide);
+			if (correction == Opcode::Mov) shift += 32;
+			else ass.add(Opcode::Sar, i64, immediate_operand(32), wide);
+		}
+		else {
+			MachineOperand factor = temporary();
+			load_constant(multiplier, i64, factor);
+			ass.add(Opcode::Mov, i64, reg(x), register_operand(rax));
+			ass.add(Opcode::Imul, i64, MachineOperand(), factor);
+			ass.add(Opcode::Mov, i64, register_operand(rdx), wide);
+		}
+		if (correction != Opcode::Mov) ass.add(correction, i64, extended, wide);
+		if (shift > 0) ass.add(Opcode::Sar, i64, immediate_operand(shift), wide);
+		// rounding toward 0 adds 1 to a negative quotient
+		MachineOperand sign = temporary();
+		ass.add(Opcode::Mov, i64, wide, sign);
+		sign.s = s;
+		ass.add(Opcode::Shr, s, immediate_operand(bits - 1), sign);
+		ass.add(Opcode::Add, s, sign, quotient);
+		if (!remainder) return true;
+		if (d == (int)d) ass.add(Opcode::Imul, s, immediate_operand((int)d), quotient);
+		else {
+			MachineOperand divisor = temporary();
+			load_constant(d, i64, divisor);
+			divisor.s = s;
+			ass.add(Opcode::Imul, s, divisor, quotient);
+		}
+		ass.add(Opcode::Mov, i64, reg(x), reg(v));
+		ass.add(Opcode::Sub, s, quotient, result);
+		return true;
+	}
+
+	void select_call(ir_value v, const IrInstr& in) {
+		int count = (int)in.args.size();
+		int registers = 0;
+		for (int i = 0; i < count || (convention.home_slots && i < convention.register_count); i++) {
+			int slot = convention.slot(i);
+			if (slot >= 0) outgoing_size = std::max(outgoing_size, slot + 8);
+			if (slot >= 0 && i < count) ass.add(Opcode::Mov, i64, reg(in.args[i]), memory_operand(rsp, slot));
+		}
+		for (int i = 0; i < count && i < convention.register_count; i++) {
+			ass.add(Opcode::Mov, i64, reg(in.args[i]), register_operand(convention.registers[i]));
+			registers |= 1 << convention.registers[i];
+		}
+		if (!convention.home_slots) {
+			ass.add(Opcode::Mov, i32, immediate_operand(0), register_operand(rax, i32));
+			registers |= 1 << rax;
+		}
+		MachineOperand callee = in.name != NO_SYMBOL ? symbol_operand(in.name) : reg(in.a);
+		if (ass.object && in.name != NO_SYMBOL) {
+			object_symbol& s = ass.object->symbols[ass.object->symbol_index(in.name)];
+			s.arguments = std::max(s.arguments, count);
+		}
+		ass.add(Opcode::Call, i64, immediate_operand(registers), callee);
+		ass.add(Opcode::Mov, i64, register_operand(rax), reg(v));
+	}
+
+	// a label past those of the blocks, for control flow within an instruction's code
+	MachineOperand new_label() {
+		return label_operand(LabelType::Block, block_labels++);
+	}
+
+	// the vector operations loop over 16 bytes at a time in xmm0 and xmm1, or 32 in ymm0 and
+	// ymm1 with AVX2, which nothing else uses. counts fill whole 32 byte chunks. addresses compare
+	// as signed, which user space addresses are either way
+	void vector_loop_bounds(const IrInstr& in, ir_value start, const MachineOperand& pointer, const MachineOperand& end, const MachineOperand& bytes) {
+		ass.add(Opcode::Mov, i64, reg(start), pointer);
+		ass.add(Opcode::Mov, i64, reg(in.a), bytes);
+		if (in.element != i8) ass.add(Opcode::Sal, i64, immediate_operand((int)in.element), bytes);
+		ass.add(Opcode::Mov, i64, pointer, end);
+		ass.add(Opcode::Add, i64, bytes, end);
+	}
+
+	void select_vector_map(ir_value v, const IrInstr& in) {
+		bool ymm = ass.avx2;
+		int step = ymm ? 32 : 16;
+		MachineOperand x0 = vector_operand(0, ymm), x1 = vector_operand(1, ymm);
+		MachineOperand dst = temporary(), end = temporary(), bytes = temporary();
+		MachineOperand sources[2] = { temporary(), temporary() };
+		vector_loop_bounds(in, in.args[0], dst, end, bytes);
+		MachineOperand overlap = new_label(), loop = new_label(), finished = new_label(), out = new_label();
+		// either source may be dst itself, but mustn't overlap it otherwise
+		for (int k = 0; k < 2; k++) {
+			MachineOperand apart = new_label(), source_end = temporary();
+			ass.add(Opcode::Mov, i64, reg(in.args[k + 1]), sources[k]);
+			ass.add(Opcode::Cmp, i64, dst, sources[k]);
+			ass.add(Opcode::Je, apart);
+			ass.add(Opcode::Cmp, i64, end, sources[k]);
+			ass.add(Opcode::Jge, apart);
+			ass.add(Opcode::Mov, i64, sources[k], source_end);
+			ass.add(Opcode::Add, i64, bytes, source_end);
+			ass.add(Opcode::Cmp, i64, source_end, dst);
+			ass.add(Opcode::Jl, overlap);
+			ass.add(Opcode::Label, apart);
+		}
+		ass.add(Opcode::Label, loop);
+		ass.add(Opcode::Cmp, i64, end, dst);
+		ass.add(Opcode::Jge, finished);
+		ass.add(Opcode::Movdqu, i64, virtual_memory_operand(sources[0].virt, 0), x0);
+		ass.add(Opcode::Movdqu, i64, virtual_memory_operand(sources[1].virt, 0), x1);
+		Opcode op = (IrOp)in.constant == IrOp::Add ? Opcode::Padd : (IrOp)in.constant == IrOp::Sub ? Opcode::Psub
+			: (IrOp)in.constant == IrOp::And ? Opcode::Pand : (IrOp)in.constant == IrOp::Or ? Opcode::Por : Opcode::Pxor;
+		ass.add(op, in.element, x1, x0);
+		ass.add(Opcode::Movdqu, i64, x0, virtual_memory_operand(dst.virt, 0));
+		ass.add(Opcode::Add, i64, immediate_operand(step), dst);
+		ass.add(Opcode::Add, i64, immediate_operand(step), sources[0]);
+		ass.add(Opcode::Add, i64, immediate_operand(step), sources[1]);
+		ass.add(Opcode::Jmp, loop);
+		ass.add(Opcode::Label, finished);
+		if (ymm) ass.add(Opcode::Vzeroupper);
+		ass.add(Opcode::Mov, i64, reg(in.a), reg(v));
+		ass.add(Opcode::Jmp, out);
+		ass.add(Opcode::Label, overlap);
+		load_constant(0, i64, reg(v));
+		ass.add(Opcode::Label, out);
+	}
+
+	// the sum of each lane, then of the halves of xmm0 folded onto each other down to one
+	// element
+	void select_vector_sum(ir_value v, const IrInstr& in) {
+		bool ymm = ass.avx2;
+		int step = ymm ? 32 : 16;
+		MachineOperand x0 = vector_operand(0, ymm), x1 = vector_operand(1, ymm);
+		MachineOperand pointer = temporary(), end = temporary(), bytes = temporary();
+		vector_loop_bounds(in, in.b, pointer, end, bytes);
+		MachineOperand loop = new_label(), finished = new_label();
+		ass.add(Opcode::Pxor, i64, x0, x0);
+		ass.add(Opcode::Label, loop);
+		ass.add(Opcode::Cmp, i64, end, pointer);
+		ass.add(Opcode::Jge, finished);
+		ass.add(Opcode::Movdqu, i64, virtual_memory_operand(pointer.virt, 0), x1);
+		ass.add(Opcode::Padd, in.element, x1, x0);
+		ass.add(Opcode::Add, i64, immediate_operand(step), pointer);
+		ass.add(Opcode::Jmp, loop);
+		ass.add(Opcode::Label, finished);
+		x0 = vector_operand(0);
+		x1 = vector_operand(1);
+		if (ymm) {
+			ass.add(Opcode::Vextracti128, i64, vector_operand(0, true), x1);
+			ass.add(Opcode::Vzeroupper);
+			ass.add(Opcode::Padd, in.element, x1, x0);
+		}
+		for (int shift = 8; shift >= _bytes(in.element); shift /= 2) {
+			ass.add(Opcode::Movdqu, i64, x0, x1);
+			ass.add(Opcode::Psrldq, i64, immediate_operand(shift), x1);
+			ass.add(Opcode::Padd, in.element, x1, x0);
+		}
+		ass.add(Opcode::Movq, i64, x0, reg(v));
+	}
+
+	void select(ir_value v, unsigned int next_block) {
+		const IrInstr& in = f.instrs[v];
+		switch (in.op) {
+		case IrOp::Const:
+			load_constant(in.constant, in.type, reg(v));
+			break;
+		case IrOp::Param:
+			if (in.constant < convention.register_count) ass.add(Opcode::Mov, i64, register_operand(convention.registers[in.constant]), reg(v));
+			else ass.add(Opcode::Mov, i64, memory_operand(rbp, 16 + convention.slot((int)in.constant)), reg(v));
+			break;
+		case IrOp::Alloca:
+			ass.add(Opcode::Lea, i64, memory_operand(rbp, slots[v]), reg(v));
+			break;
+		case IrOp::Symbol:
+			ass.add(Opcode::Mov, i64, symbol_address_operand(in.name), reg(v));
+			break;
+		case IrOp::Add: case IrOp::Sub: case IrOp::Mul: case IrOp::Div: case IrOp::Mod:
+		case IrOp::And: case IrOp::Or: case IrOp::Xor: case IrOp::Shl: case IrOp::Shr: {
+			long long c;
+			if (in.op == IrOp::Mul && constant_of(in.b, in.type, c) && select_multiply(v, in.a, c)) break;
+			if (in.op == IrOp::Mul && constant_of(in.a, in.type, c) && select_multiply(v, in.b, c)) break;
+			if ((in.op == IrOp::Div || in.op == IrOp::Mod) && constant_of(in.b, in.type, c) && select_divide(v, in.a, c, in.op == IrOp::Mod)) break;
+			DataType type = type_of_width(in.type);
+			const operator_code* code = find_binary_operator(type, table_operator(in.op), type);
+			ass.add(Opcode::Mov, i64, reg(in.a), reg(v));
+			emit(code, ass, reg(v), reg(in.b), next_virtual++);
+			break;
+		}
+		case IrOp::Neg:
+		case IrOp::Not:
+			ass.add(Opcode::Mov, i64, reg(in.a), reg(v));
+			emit(find_unary_operator(type_of_width(in.type), in.op == IrOp::Neg ? negation : bitwise_complement), ass, reg(v), MachineOperand(), next_virtual++);
+			break;
+		case IrOp::Eq: case IrOp::Ne: case IrOp::Lt: case IrOp::Gt: case IrOp::Le: case IrOp::Ge:
+			if (fused[v]) break;
+			// mov leaves the flags alone, so the result can be cleared between the cmp and the set
+			ass.add(Opcode::Cmp, f.instrs[in.a].type, operand(in.b), width_of(in.a));
+			ass.add(Opcode::Mov, i32, immediate_operand(0), reg(v, i32));
+			ass.add(set_condition(in.op), i8, reg(v, i8));
+			break;
+		case IrOp::Sext:
+			ass.add(Opcode::Movsx, f.instrs[in.a].type, width_of(in.a), reg(v));
+			break;
+		case IrOp::Trunc:
+			ass.add(Opcode::Mov, i64, reg(in.a), reg(v));
+			break;
+		case IrOp::Load:
+			ass.add(in.type >= i32 ? Opcode::Mov : Opcode::Movsx, in.type, memory(in.a, in.constant), in.type >= i32 ? reg(v, in.type) : reg(v));
+			break;
+		case IrOp::Store: {
+			size s = f.instrs[in.b].type;
+			ass.add(Opcode::Mov, s, reg(in.b, s), memory(in.a, in.constant));
+			break;
+		}
+		case IrOp::Call:
+			select_call(v, in);
+			break;
+		case IrOp::VecMap:
+			select_vector_map(v, in);
+			break;
+		case IrOp::VecSum:
+			select_vector_sum(v, in);
+			break;
+		case IrOp::Phi:
+			break;
+		case IrOp::Jmp:
+			phi_copies(in.block, in.targets[0]);
+			if (in.targets[0] != next_block) ass.add(Opcode::Jmp, label(in.targets[0]));
+			break;
+		case IrOp::Br: {
+			// a fused comparison jumps on its own flags, anything else on not being 0
+			const IrInstr& condition = f.instrs[in.a];
+			IrOp test = IrOp::Ne;
+			if (fused[in.a]) {
+				test = condition.op;
+				ass.add(Opcode::Cmp, f.instrs[condition.a].type, operand(condition.b), width_of(condition.a));
+			}
+			else ass.add(Opcode::Cmp, condition.type, immediate_operand(0), width_of(in.a));
+			if (in.targets[0] == next_block) ass.add(jump_condition(test, true), label(in.targets[1]));
+			else {
+				ass.add(jump_condition(test, false), label(in.targets[0]));
+				if (in.targets[1] != next_block) ass.add(Opcode::Jmp, label(in.targets[1]));
+			}
+			break;
+		}
+		case IrOp::Ret:
+			if (in.a != NO_VALUE) ass.add(Opcode::Mov, i64, reg(in.a), register_operand(rax));
+			ass.add(Opcode::Ret);
+			break;
+		}
+	}
+
+	void run() {
+		size_t original_blocks = f.blocks.size();
+		split_critical_edges(f);
+		// blocks stay in source order, with the blocks split off an edge right after the
+		// block the edge leaves
+		std::vector<unsigned int> layout;
+		for (unsigned int b = 0; b < original_blocks; b++) {
+			layout.push_back(b);
+			for (unsigned int e = (unsigned int)original_blocks; e < f.blocks.size(); e++) {
+				if (f.blocks[e].predecessors[0] == b) layout.push_back(e);
+			}
+		}
+		next_virtual = (unsigned int)f.instrs.size();
+		slots.assign(f.instrs.size(), 0);
+		fused.assign(f.instrs.size(), false);
+		std::vector<unsigned int> uses(f.instrs.size(), 0);
+		for (const IrBlock& b : f.blocks) {
+			for (ir_value v : b.code) {
+				const IrInstr& in = f.instrs[v];
+				uses[in.a]++;
+				uses[in.b]++;
+				for (ir_value arg : in.args) uses[arg]++;
+			}
+		}
+		for (const IrBlock& b : f.blocks) {
+			const IrInstr& last = f.instrs[b.code.back()];
+			if (last.op != IrOp::Br) continue;
+			IrOp op = f.instrs[last.a].op;
+			if (op >= IrOp::Eq && op <= IrOp::Ge && f.instrs[last.a].block == last.block && uses[last.a] == 1) fused[last.a] = true;
+		}
+		first_label = block_labels;
+		block_labels += (int)f.blocks.size();
+		for (ir_value v = 1; v < f.instrs.size(); v++) {
+			if (f.instrs[v].op != IrOp::Alloca || f.instrs[v].removed) continue;
+			frame_size += ((int)f.instrs[v].constant + 7) / 8 * 8;
+			slots[v] = -frame_size;
+		}
+
+		ass.add(Opcode::Globl, symbol_operand(f.name));
+		ass.add(Opcode::Label, symbol_operand(f.name));
+		size_t body = ass.code.size();
+		for (size_t i = 0; i < layout.size(); i++) {
+			unsigned int b = layout[i];
+			unsigned int next = i + 1 < layout.size() ? layout[i + 1] : ~0u;
+			if (b != 0) ass.add(Opcode::Label, label(b));
+			for (ir_value v : f.blocks[b].code) select(v, next);
+		}
+		allocate_registers(ass.code, body, frame_size, outgoing_size);
+	}
+};
+
+void select_instructions(ir_function& f, assembly& ass) {
+	instruction_selection selection(f, ass);
+	selection.run();
+}
@@ -0,0 +1,184 @@
+#include "jit.h"
+#include <climits>
+#include <cstring>
+#include <exception>
+#include <string>
+
+// every stub is the same code with the address of its function in the last 8 bytes. it
+// aligns the stack to 16 bytes, which generated code doesn't keep, and copies the stack
+// arguments into the new frame before calling through the address. it doesn't know how
+// many there are, so it copies as many as a call to an import may pass
+const size_t STUB_SIZE = 80;
+const int STUB_ARGUMENTS = 16;
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+// generated code already passes arguments the Windows way. the stub leaves the 32 bytes
+// of shadow space the callee may use and copies arguments 5 to 16 above them
+const unsigned char import_stub[] = {
+	0x55,                                     // push %rbp
+	0x48, 0x89, 0xe5,                         // mov %rsp, %rbp
+	0x48, 0x83, 0xe4, 0xf0,                   // and $-16, %rsp
+	0x48, 0x81, 0xec, 0x80, 0x00, 0x00, 0x00, // sub $128, %rsp
+	0x41, 0xbb, 0x0c, 0x00, 0x00, 0x00,       // mov $12, %r11d
+	0x4a, 0x8b, 0x44, 0xdd, 0x28,             // 1: mov 40(%rbp,%r11,8), %rax
+	0x4a, 0x89, 0x44, 0xdc, 0x18,             // mov %rax, 24(%rsp,%r11,8)
+	0x41, 0xff, 0xcb,                         // dec %r11d
+	0x75, 0xf1,                               // jnz 1b
+	0xff, 0x15, 0x02, 0x00, 0x00, 0x00,       // call *2(%rip)
+	0xc9,                                     // leave
+	0xc3                                      // ret
+};
+
+// code refers to functions by 32 bit sign extended addresses, so it has to be in the
+// low 2 GB. VirtualAlloc has no flag for that, so addresses are tried from the bottom up
+void* allocate_low(size_t length) {
+	for (unsigned long long address = 0x10000000; address + length < 0x80000000; address += 0x10000) {
+		void* memory = VirtualAlloc((void*)address, length, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (memory) return memory;
+	}
+	return nullptr;
+}
+
+bool make_executable(void* memory, size_t length) {
+	DWORD old;
+	if (!VirtualProtect(memory, length, PAGE_EXECUTE_READ, &old)) return false;
+	FlushInstructionCache(GetCurrentProcess(), memory, length);
+	return true;
+}
+
+void release(void* memory, size_t length) {
+	VirtualFree(memory, 0, MEM_RELEASE);
+}
+
+void* find_import(const std::string& name) {
+	const char* modules[] = { "ucrtbase.dll", "msvcrt.dll", "kernel32.dll" };
+	for (const char* module : modules) {
+		HMODULE handle = LoadLibraryA(module);
+		if (!handle) continue;
+		FARPROC function = GetProcAddress(handle, name.c_str());
+		if (function) return (void*)function;
+	}
+	return nullptr;
+}
+
+#else
+#include <dlfcn.h>
+#include <sys/mman.h>
+
+// generated code passes arguments the Windows way, in rcx, rdx, r8 and r9 and then on the
+// stack above 32 bytes of shadow space. the System V ABI expects six in rdi, rsi, rdx, rcx,
+// r8 and r9, and the rest on the stack, which the stub copies for arguments 7 to 16. al
+// holds the number of vector arguments to a variadic function, which is always none
+const unsigned char import_stub[] = {
+	0x55,                               // push %rbp
+	0x48, 0x89, 0xe5,                   // mov %rsp, %rbp
+	0x48, 0x83, 0xe4, 0xf0,             // and $-16, %rsp
+	0x48, 0x83, 0xec, 0x50,             // sub $80, %rsp
+	0x41, 0xbb, 0x0a, 0x00, 0x00, 0x00, // mov $10, %r11d
+	0x4a, 0x8b, 0x44, 0xdd, 0x38,       // 1: mov 56(%rbp,%r11,8), %rax
+	0x4a, 0x89, 0x44, 0xdc, 0xf8,       // mov %rax, -8(%rsp,%r11,8)
+	0x41, 0xff, 0xcb,                   // dec %r11d
+	0x75, 0xf1,                         // jnz 1b
+	0x48, 0x89, 0xcf,                   // mov %rcx, %rdi
+	0x48, 0x89, 0xd6,                   // mov %rdx, %rsi
+	0x4c, 0x89, 0xc2,                   // mov %r8, %rdx
+	0x4c, 0x89, 0xc9,                   // mov %r9, %rcx
+	0x4c, 0x8b, 0x45, 0x30,             // mov 48(%rbp), %r8
+	0x4c, 0x8b, 0x4d, 0x38,             // mov 56(%rbp), %r9
+	0x31, 0xc0,                         // xor %eax, %eax
+	0xff, 0x15, 0x02, 0x00, 0x00, 0x00, // call *2(%rip)
+	0xc9,                               // leave
+	0xc3                                // ret
+};
+
+// code refers to functions by 32 bit sign extended addresses, so it has to be in the low 2 GB
+void* allocate_low(size_t length) {
+#ifdef MAP_32BIT
+	void* memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+#else
+	void* memory = mmap((void*)0x40000000, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#endif
+	return memory == MAP_FAILED ? nullptr : memory;
+}
+
+bool make_executable(void* memory, size_t length) {
+	return mprotect(memory, length, PROT_READ | PROT_EXEC) == 0;
+}
+
+void release(void* memory, size_t length) {
+	munmap(memory, length);
+}
+
+void* find_import(const std::string& name) {
+	return dlsym(RTLD_DEFAULT, name.c_str());
+}
+
+#endif
+
+static_assert(sizeof(import_stub) + 8 <= STUB_SIZE, "import stub doesn't fit in STUB_SIZE");
+
+jit_image::jit_image(const object_file& obj)
+	: obj(obj) {
+	// the code, then a stub for each symbol it doesn't define
+	size_t stubs = (obj.text.size() + 15) / 16 * 16;
+	std::vector<unsigned long long> addresses(obj.symbols.size());
+	size_t stub_count = 0;
+	for (const object_symbol& s : obj.symbols) {
+		if (!s.defined) stub_count++;
+	}
+	length = stubs + stub_count * STUB_SIZE;
+	if (length == 0) return;
+	memory = (unsigned char*)allocate_low(length);
+	if (!memory) throw std::exception("Could not allocate JIT memory");
+	memcpy(memory, obj.text.data(), obj.text.size());
+
+	unsigned char* stub = memory + stubs;
+	for (size_t i = 0; i < obj.symbols.size(); i++) {
+		const object_symbol& s = obj.symbols[i];
+		if (s.defined) {
+			addresses[i] = (unsigned long long)(memory + s.offset);
+			continue;
+		}
+		void* function = find_import(symbol_name(s.name));
+		if (!function) {
+			release(memory, length);
+			throw std::exception("Undefined symbol in JIT code");
+		}
+		if (s.arguments > STUB_ARGUMENTS) {
+			release(memory, length);
+			throw std::exception("Too many arguments to a function outside JIT code");
+		}
+		memcpy(stub, import_stub, sizeof(import_stub));
+		memcpy(stub + sizeof(import_stub), &function, 8);
+		addresses[i] = (unsigned long long)stub;
+		stub += STUB_SIZE;
+	}
+
+	for (const relocation& r : obj.relocations) {
+		long long value = (long long)addresses[r.symbol] + r.addend;
+		if (r.type == RelocationType::Call) value -= (long long)(memory + r.offset);
+		if (value < INT_MIN || value > INT_MAX) {
+			release(memory, length);
+			throw std::exception("JIT code is out of reach of a 32 bit address");
+		}
+		int field = (int)value;
+		memcpy(memory + r.offset, &field, 4);
+	}
+	if (!make_executable(memory, length)) {
+		release(memory, length);
+		throw std::exception("Could not make JIT code executable");
+	}
+}
+
+jit_image::~jit_image() {
+	if (memory) release(memory, length);
+}
+
+void* jit_image::address(symbol name) const {
+	const object_symbol* s = obj.find_symbol(name);
+	if (!s || !s->defined) return nullptr;
+	return memory + s->offset;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <vector>
+#include "object.h"
+
+// an object's code loaded into executable memory in this process, so it can be called
+// without writing, linking or starting anything. symbols the object doesn't define are
+// looked up in the C runtime, and calls to them go through a stub that moves up to 16
+// arguments from where the generated code passes them to where the platform expects them
+struct jit_image {
+	jit_image(const object_file& obj); // obj has to outlive the image
+	~jit_image();
+
+	jit_image(const jit_image&) = delete;
+	jit_image& operator=(const jit_image&) = delete;
+
+	// the address of a symbol the object defines, nullptr if it doesn't
+	void* address(symbol name) const;
+
+private:
+	unsigned char* memory = nullptr;
+	size_t length = 0;
+	const object_file& obj;
+};
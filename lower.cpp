@@ -0,0 +1,854 @@
+#include "ast.h"
+#include "ir.h"
+#include <set>
+#include <unordered_map>
+
+// lowers the tree to SSA form. variables whose address is never taken become values, with
+// phis placed as they're read, after Braun et al., "Simple and Efficient Construction of
+// Static Single Assignment Form": a block is sealed once all its predecessors are known, and
+// reading a variable in a block that isn't sealed yet leaves a phi to be completed then.
+// structs and variables whose address is taken live in the frame. arithmetic follows C,
+// with char and short promoted to int, as in the bytecode backend
+
+struct ir_variable {
+	symbol name;
+	DataType type;
+	unsigned int ssa;          // the variable's number for SSA construction, if it's a value
+	ir_value address = NO_VALUE; // the variable's memory otherwise
+};
+
+// where the value of an expression is
+struct ir_lowered {
+	ir_value v = NO_VALUE; // the value, or the address for memory
+	DataType type;
+	bool in_memory = false;
+	int offset = 0;      // added to the address
+	int variable = -1;   // the SSA variable the value is, so writing it assigns the variable
+};
+
+struct ir_loop {
+	unsigned int break_target, continue_target;
+};
+
+struct ir_lowering {
+	const Application& app;
+	std::unordered_map<symbol, const Function*> declarations; // every function, for return and parameter types
+	std::unordered_map<int, const Struct*> structs; // by DataType id
+
+	ir_function* f = nullptr;
+	unsigned int current = 0; // the block code goes into
+	std::vector<ir_variable> variables; // innermost last
+	std::vector<ir_loop> loops;
+	std::set<symbol> address_taken;
+	DataType return_type;
+
+	// SSA construction state, by block
+	std::vector<size> ssa_widths; // of each SSA variable
+	std::vector<std::unordered_map<unsigned int, ir_value>> definitions;
+	std::vector<std::vector<std::pair<unsigned int, ir_value>>> incomplete_phis;
+	std::vector<bool> sealed;
+
+	ir_lowering(const Application& app)
+		: app(app) {
+	}
+
+	static bool is_struct(const DataType& t) {
+		return t.id > 4 && t.pointers == 0;
+	}
+
+	static DataType rvalue(DataType t) {
+		t.lvalue = false;
+		return t;
+	}
+
+	static DataType pointed_to(const DataType& t) {
+		return DataType(t.id, t.pointers - 1, false, t.sz);
+	}
+
+	static size width(const DataType& t) {
+		return t.pointers || t.id > 4 ? i64 : _size(t.sz);
+	}
+
+	int size_of(const DataType& t) {
+		if (t.pointers) return 8;
+		if (t.id <= 4) return t.sz;
+		return 8 * (int)struct_of(t).fields.size();
+	}
+
+	const Struct& struct_of(const DataType& t) {
+		auto s = structs.find(t.id);
+		if (s == structs.end()) throw std::exception("Unknown struct");
+		return *s->second;
+	}
+
+	unsigned int new_block() {
+		f->blocks.push_back(IrBlock());
+		definitions.emplace_back();
+		incomplete_phis.emplace_back();
+		sealed.push_back(false);
+		return (unsigned int)f->blocks.size() - 1;
+	}
+
+	ir_value emit(IrOp op, size type, ir_value a = NO_VALUE, ir_value b = NO_VALUE, long long constant = 0) {
+		IrInstr in;
+		in.op = op;
+		in.type = type;
+		in.a = a;
+		in.b = b;
+		in.constant = constant;
+		return f->add(current, std::move(in));
+	}
+
+	ir_value constant(long long value, size type) {
+		return emit(IrOp::Const, type, NO_VALUE, NO_VALUE, value);
+	}
+
+	bool terminated() {
+		const IrBlock& b = f->blocks[current];
+		return !b.code.empty() && is_terminator(f->instrs[b.code.back()].op);
+	}
+
+	void jump(unsigned int target) {
+		if (terminated()) return;
+		IrInstr in;
+		in.op = IrOp::Jmp;
+		in.targets[0] = target;
+		f->add(current, std::move(in));
+		f->blocks[target].predecessors.push_back(current);
+	}
+
+	void branch(ir_value condition, unsigned int if_true, unsigned int if_false) {
+		IrInstr in;
+		in.op = IrOp::Br;
+		in.a = condition;
+		in.targets[0] = if_true;
+		in.targets[1] = if_false;
+		f->add(current, std::move(in));
+		f->blocks[if_true].predecessors.push_back(current);
+		f->blocks[if_false].predecessors.push_back(current);
+	}
+
+	// code after a return, break or continue goes into a block nothing jumps to
+	void start_unreachable() {
+		current = new_block();
+		seal(current);
+	}
+
+	// SSA construction
+
+	ir_value new_phi(unsigned int block, size type) {
+		IrInstr in;
+		in.op = IrOp::Phi;
+		in.type = type;
+		in.block = block;
+		f->instrs.push_back(std::move(in));
+		ir_value phi = (ir_value)f->instrs.size() - 1;
+		std::vector<ir_value>& code = f->blocks[block].code;
+		code.insert(code.begin(), phi);
+		return phi;
+	}
+
+	void write_variable(unsigned int variable, unsigned int block, ir_value v) {
+		definitions[block][variable] = v;
+	}
+
+	ir_value read_variable(unsigned int variable, unsigned int block) {
+		auto d = definitions[block].find(variable);
+		if (d != definitions[block].end()) return d->second;
+		ir_value v;
+		const std::vector<unsigned int>& predecessors = f->blocks[block].predecessors;
+		if (!sealed[block]) {
+			v = new_phi(block, ssa_widths[variable]);
+			incomplete_phis[block].push_back({ variable, v });
+		}
+		else if (predecessors.size() == 1) v = read_variable(variable, predecessors[0]);
+		else if (predecessors.empty()) {
+			// only code that can't run reads a variable nothing wrote
+			IrInstr zero;
+			zero.op = IrOp::Const;
+			zero.type = ssa_widths[variable];
+			zero.block = 0;
+			f->instrs.push_back(std::move(zero));
+			v = (ir_value)f->instrs.size() - 1;
+			f->blocks[0].code.insert(f->blocks[0].code.begin(), v);
+		}
+		else {
+			// the phi is written first so a loop back to this block finds it
+			v = new_phi(block, ssa_widths[variable]);
+			write_variable(variable, block, v);
+			add_phi_operands(variable, v);
+		}
+		write_variable(variable, block, v);
+		return v;
+	}
+
+	void add_phi_operands(unsigned int variable, ir_value phi) {
+		unsigned int block = f->instrs[phi].block;
+		for (unsigned int p : f->blocks[block].predecessors) {
+			ir_value v = read_variable(variable, p);
+			f->instrs[phi].args.push_back(v);
+		}
+	}
+
+	void seal(unsigned int block) {
+		for (auto& incomplete : incomplete_phis[block]) add_phi_operands(incomplete.first, incomplete.second);
+		incomplete_phis[block].clear();
+		sealed[block] = true;
+	}
+
+	// values
+
+	ir_lowered value_of(ir_value v, const DataType& type) {
+		ir_lowered l;
+		l.v = v;
+		l.type = rvalue(type);
+		return l;
+	}
+
+	ir_lowered memory_at(ir_value address, const DataType& type, int offset = 0) {
+		ir_lowered l = value_of(address, type);
+		l.type.lvalue = true;
+		l.in_memory = true;
+		l.offset = offset;
+		return l;
+	}
+
+	// the value itself, a struct's being its address
+	ir_value read(const ir_lowered& l) {
+		if (is_struct(l.type)) return address_of(l);
+		if (!l.in_memory) return l.v;
+		return emit(IrOp::Load, width(l.type), l.v, NO_VALUE, l.offset);
+	}
+
+	ir_value address_of(const ir_lowered& l) {
+		if (!l.in_memory) throw std::exception("Address of something that isn't in memory");
+		if (l.offset == 0) return l.v;
+		return emit(IrOp::Add, i64, l.v, constant(l.offset, i64));
+	}
+
+	// v of type from as a value of type to
+	ir_value convert(ir_value v, const DataType& from, const DataType& to) {
+		size a = width(from), b = width(to);
+		// a constant becomes a constant of the other width, which later passes can see through
+		if (a != b && f->instrs[v].op == IrOp::Const) {
+			long long c = f->instrs[v].constant;
+			return constant(b == i8 ? (signed char)c : b == i16 ? (short)c : b == i32 ? (int)c : c, b);
+		}
+		if (a < b) return emit(IrOp::Sext, b, v);
+		if (a > b) return emit(IrOp::Trunc, b, v);
+		return v;
+	}
+
+	// assigns value, of type value_type, to target and returns where the assigned value is
+	ir_lowered write(const ir_lowered& target, ir_value value, const DataType& value_type) {
+		if (is_struct(target.type)) throw std::exception("Struct assignment isn't supported");
+		value = convert(value, value_type, target.type);
+		if (target.in_memory) {
+			emit(IrOp::Store, width(target.type), target.v, value, target.offset);
+			return value_of(value, target.type);
+		}
+		if (target.variable < 0) throw std::exception("Assignment to something that isn't a variable");
+		write_variable((unsigned int)target.variable, current, value);
+		return value_of(value, target.type);
+	}
+
+	// the result type of arithmetic, with char and short promoted to int as in C
+	DataType arithmetic_type(const DataType& l, const DataType& r) {
+		if (l.pointers) return rvalue(l);
+		if (r.pointers) return rvalue(r);
+		if (l.id == 4 || r.id == 4) return DataType::LONG;
+		return DataType::INT;
+	}
+
+	static IrOp ir_operator(binary_operator op) {
+		switch (op) {
+		case add: return IrOp::Add;
+		case subtract: return IrOp::Sub;
+		case multiply: return IrOp::Mul;
+		case divide: return IrOp::Div;
+		case mod: return IrOp::Mod;
+		case bitwise_and: return IrOp::And;
+		case bitwise_or: return IrOp::Or;
+		case bitwise_xor: return IrOp::Xor;
+		case left_shift: return IrOp::Shl;
+		case right_shift: return IrOp::Shr;
+		case equal: return IrOp::Eq;
+		case not_equal: return IrOp::Ne;
+		case less: return IrOp::Lt;
+		case greater: return IrOp::Gt;
+		case less_equal: return IrOp::Le;
+		case greater_equal: return IrOp::Ge;
+		default: throw std::exception("Operator has no IR form");
+		}
+	}
+
+	// the operation on the values of a compound assignment
+	static binary_operator base_operator(binary_operator op) {
+		switch (op) {
+		case add_assign: return add;
+		case subtract_assign: return subtract;
+		case multiply_assign: return multiply;
+		case divide_assign: return divide;
+		case mod_assign: return mod;
+		case left_shift_assign: return left_shift;
+		case right_shift_assign: return right_shift;
+		case and_assign: return bitwise_and;
+		case or_assign: return bitwise_or;
+		case xor_assign: return bitwise_xor;
+		default: return op;
+		}
+	}
+
+	// left op right on values of types l and r, scaling integers added to pointers by the
+	// size of what they point to
+	ir_lowered arithmetic(binary_operator op, ir_value left, const DataType& l, ir_value right, const DataType& r) {
+		if (is_struct(l) || is_struct(r)) throw std::exception("Operator on a struct");
+		if (op >= equal && op <= greater_equal) {
+			DataType type = l.pointers || r.pointers ? DataType::LONG : arithmetic_type(l, r);
+			return value_of(emit(ir_operator(op), i32, convert(left, l, type), convert(right, r, type)), DataType::INT);
+		}
+		if ((op == add || op == subtract) && (l.pointers || r.pointers)) {
+			if (l.pointers && r.pointers) {
+				if (op == add) throw std::exception("Adding two pointers");
+				// the difference of two pointers counts elements
+				ir_value difference = emit(IrOp::Sub, i64, left, right);
+				int size = size_of(pointed_to(l));
+				if (size > 1) difference = emit(IrOp::Div, i64, difference, constant(size, i64));
+				return value_of(difference, DataType::LONG);
+			}
+			bool pointer_left = l.pointers != 0;
+			const DataType& pointer = pointer_left ? l : r;
+			if (!pointer_left && op == subtract) throw std::exception("Subtracting a pointer from an integer");
+			ir_value index = convert(pointer_left ? right : left, pointer_left ? r : l, DataType::LONG);
+			int size = size_of(pointed_to(pointer));
+			if (size > 1) index = emit(IrOp::Mul, i64, index, constant(size, i64));
+			ir_value base = pointer_left ? left : right;
+			return value_of(emit(ir_operator(op), i64, base, index), pointer);
+		}
+		if (l.pointers || r.pointers) throw std::exception("Operator isn't defined for pointers");
+		DataType type = arithmetic_type(l, r);
+		size w = width(type);
+		return value_of(emit(ir_operator(op), w, convert(left, l, type), convert(right, r, type)), type);
+	}
+
+	ir_value truth(ir_value v) {
+		return emit(IrOp::Ne, i32, v, constant(0, f->instrs[v].type));
+	}
+
+	ir_lowered lower_logical_operator(const Expression& exp) {
+		bool is_and = exp.op == logical_and;
+		// && gives up at the first operand that's 0, || at the first one that isn't
+		ir_value short_circuit = constant(is_and ? 0 : 1, i32);
+		unsigned int right_block = new_block(), end = new_block();
+		if (is_and) lower_condition(exp.a, right_block, end);
+		else lower_condition(exp.a, end, right_block);
+		seal(right_block);
+		current = right_block;
+		ir_value right = truth(read(lower(exp.b)));
+		unsigned int from_right = current;
+		jump(end);
+		seal(end);
+		current = end;
+		ir_value phi = new_phi(end, i32);
+		const std::vector<unsigned int>& predecessors = f->blocks[end].predecessors;
+		for (unsigned int p : predecessors) f->instrs[phi].args.push_back(p == from_right ? right : short_circuit);
+		return value_of(phi, DataType::INT);
+	}
+
+	ir_lowered lower_binary_operator(const Expression& exp) {
+		binary_operator op = (binary_operator)exp.op;
+		if (op == logical_and || op == logical_or) return lower_logical_operator(exp);
+		if (op == assignment) {
+			ir_lowered target = lower(exp.a);
+			ir_lowered right = lower(exp.b);
+			return write(target, read(right), right.type);
+		}
+		if (op >= add_assign) {
+			ir_lowered target = lower(exp.a);
+			ir_lowered right = lower(exp.b);
+			ir_value value = read(right);
+			ir_lowered result = arithmetic(base_operator(op), read(target), target.type, value, right.type);
+			return write(target, result.v, result.type);
+		}
+		ir_lowered left = lower(exp.a);
+		ir_value l = read(left);
+		ir_lowered right = lower(exp.b);
+		ir_value r = read(right);
+		return arithmetic(op, l, left.type, r, right.type);
+	}
+
+	ir_lowered lower_unary_operator(const Expression& exp) {
+		unary_operator op = (unary_operator)exp.op;
+		ir_lowered v = lower(exp.a);
+		switch (op) {
+		case address:
+			return value_of(address_of(v), DataType(v.type.id, v.type.pointers + 1, false, v.type.sz));
+		case dereference: {
+			if (v.type.pointers == 0) throw std::exception("Dereference of something that isn't a pointer");
+			return memory_at(read(v), pointed_to(v.type));
+		}
+		case prefix_increment:
+		case prefix_decrement:
+		case postfix_increment:
+		case postfix_decrement: {
+			if (is_struct(v.type)) throw std::exception("Operator on a struct");
+			int step = v.type.pointers ? size_of(pointed_to(v.type)) : 1;
+			ir_value old = read(v);
+			size w = width(v.type);
+			IrOp operation = op == prefix_increment || op == postfix_increment ? IrOp::Add : IrOp::Sub;
+			ir_lowered updated = write(v, emit(operation, w, old, constant(step, w)), v.type);
+			if (op == postfix_increment || op == postfix_decrement) return value_of(old, v.type);
+			return updated;
+		}
+		default: {
+			if (is_struct(v.type)) throw std::exception("Operator on a struct");
+			ir_value operand = read(v);
+			if (op == logical_negation) return value_of(emit(IrOp::Eq, i32, operand, constant(0, width(v.type))), DataType::INT);
+			DataType type = v.type.pointers ? DataType::LONG : arithmetic_type(v.type, DataType::INT);
+			operand = convert(operand, v.type, type);
+			if (op == plus) return value_of(operand, type);
+			return value_of(emit(op == negation ? IrOp::Neg : IrOp::Not, width(type), operand), type);
+		}
+		}
+	}
+
+	ir_lowered lower_ternary(const Expression& exp) {
+		ir_value condition = read(lower(exp.a));
+		unsigned int if_block = new_block(), else_block = new_block(), end = new_block();
+		branch(condition, if_block, else_block);
+		seal(if_block);
+		seal(else_block);
+		current = if_block;
+		ir_lowered if_value = lower(app.children[exp.b]);
+		DataType type = rvalue(if_value.type);
+		if (is_struct(type)) throw std::exception("Struct in a conditional expression");
+		ir_value if_result = read(if_value);
+		jump(end);
+		unsigned int from_if = current;
+		current = else_block;
+		ir_lowered else_value = lower(app.children[exp.b + 1]);
+		ir_value else_result = convert(read(else_value), else_value.type, type);
+		jump(end);
+		seal(end);
+		current = end;
+		ir_value phi = new_phi(end, width(type));
+		for (unsigned int p : f->blocks[end].predecessors) f->instrs[phi].args.push_back(p == from_if ? if_result : else_result);
+		return value_of(phi, type);
+	}
+
+	// the field called name of a struct in memory
+	ir_lowered member(const ir_lowered& s, symbol name) {
+		const Struct& st = struct_of(s.type);
+		for (size_t i = 0; i < st.fields.size(); i++) {
+			const Line& field = app.lines[st.fields[i]];
+			if (field.b == (node_index)name) return memory_at(s.v, app.types[field.c], s.offset + 8 * (int)i);
+		}
+		throw std::exception("Unknown struct field");
+	}
+
+	bool has_field(const Struct& s, symbol name) {
+		for (node_index field : s.fields) {
+			if (app.lines[field].b == (node_index)name) return true;
+		}
+		return false;
+	}
+
+	// the struct a member access reads from, in memory
+	ir_lowered struct_operand(const Expression& exp) {
+		ir_lowered object = lower(exp.a);
+		if (exp.type == ExpressionType::PointerMemberAccess) {
+			if (object.type.pointers != 1 || object.type.id <= 4) throw std::exception("-> on something that isn't a pointer to a struct");
+			return memory_at(read(object), pointed_to(object.type));
+		}
+		if (!is_struct(object.type) || !object.in_memory) throw std::exception(". on something that isn't a struct");
+		return object;
+	}
+
+	// an argument as a 64 bit value, converted to the parameter type when it's known.
+	// structs are passed by address
+	ir_value lower_argument(node_index e, const DataType* param) {
+		ir_lowered v = lower(e);
+		ir_value value = read(v);
+		if (is_struct(v.type)) return value;
+		DataType type = rvalue(v.type);
+		if (param && !is_struct(*param) && !param->lvalue) {
+			value = convert(value, type, *param);
+			type = *param;
+		}
+		return convert(value, type, DataType::LONG);
+	}
+
+	ir_lowered lower_function_call(const Expression& exp) {
+		const Expression& callee = app.expressions[exp.a];
+		const node_index* params = app.children.data() + exp.b;
+		int count = exp.op;
+		IrInstr call;
+		call.op = IrOp::Call;
+		const Function* declaration = nullptr;
+
+		if (callee.type == ExpressionType::VariableRef && !find_variable(callee.a)) {
+			call.name = callee.a;
+			auto d = declarations.find(call.name);
+			if (d != declarations.end()) declaration = d->second;
+		}
+		else if (callee.type == ExpressionType::MemberAccess || callee.type == ExpressionType::PointerMemberAccess) {
+			ir_lowered s = struct_operand(callee);
+			const Struct& st = struct_of(s.type);
+			if (!has_field(st, callee.b)) {
+				// a method gets the address of its struct as the first argument, this
+				call.name = intern(symbol_name(st.name) + "____" + symbol_name(callee.b));
+				auto d = declarations.find(call.name);
+				if (d == declarations.end()) throw std::exception("Unknown method");
+				declaration = d->second;
+				call.args.push_back(address_of(s));
+			}
+			else call.a = read(member(s, callee.b));
+		}
+		else call.a = read(lower(exp.a));
+
+		size_t first = call.args.size();
+		if (declaration && declaration->params.size() != first + count) throw std::exception("Wrong number of arguments");
+		for (int i = 0; i < count; i++) {
+			call.args.push_back(lower_argument(params[i], declaration ? &declaration->params[first + i].second : nullptr));
+		}
+		DataType type = declaration ? declaration->return_type : DataType::LONG;
+		call.type = type.id == 0 && type.pointers == 0 ? i64 : width(type);
+		ir_value result = f->add(current, std::move(call));
+		return value_of(result, type);
+	}
+
+	ir_lowered lower_string(const std::string& s) {
+		IrInstr call;
+		call.op = IrOp::Call;
+		call.name = intern("malloc");
+		call.args.push_back(constant((long long)s.size() + 1, i64));
+		ir_value address = f->add(current, std::move(call));
+		for (size_t i = 0; i <= s.size(); i++) {
+			emit(IrOp::Store, i8, address, constant(i < s.size() ? s[i] : 0, i8), (long long)i);
+		}
+		return value_of(address, DataType::CHAR_PTR);
+	}
+
+	const ir_variable* find_variable(symbol name) {
+		for (size_t i = variables.size(); i-- > 0;) {
+			if (variables[i].name == name) return &variables[i];
+		}
+		return nullptr;
+	}
+
+	ir_lowered lower_variable_ref(const Expression& exp) {
+		const ir_variable* var = find_variable(exp.a);
+		if (!var) {
+			// anything else is a function
+			IrInstr in;
+			in.op = IrOp::Symbol;
+			in.name = exp.a;
+			return value_of(f->add(current, std::move(in)), DataType::LONG);
+		}
+		if (var->address != NO_VALUE) return memory_at(var->address, var->type);
+		ir_lowered v = value_of(read_variable(var->ssa, current), var->type);
+		v.type.lvalue = true;
+		v.variable = (int)var->ssa;
+		return v;
+	}
+
+	ir_lowered lower(node_index e) {
+		const Expression& exp = app.expressions[e];
+		switch (exp.type) {
+		case ExpressionType::BinaryOperator: return lower_binary_operator(exp);
+		case ExpressionType::UnaryOperator: return lower_unary_operator(exp);
+		case ExpressionType::Ternary: return lower_ternary(exp);
+		case ExpressionType::FunctionCall: return lower_function_call(exp);
+		case ExpressionType::VariableRef: return lower_variable_ref(exp);
+		case ExpressionType::MemberAccess:
+		case ExpressionType::PointerMemberAccess: return member(struct_operand(exp), exp.b);
+		case ExpressionType::ConstantChar: return value_of(constant((char)exp.a, i8), DataType::CHAR);
+		case ExpressionType::ConstantShort: return value_of(constant((short)exp.a, i16), DataType::SHORT);
+		case ExpressionType::ConstantInt: return value_of(constant((int)exp.a, i32), DataType::INT);
+		case ExpressionType::ConstantLong: return value_of(constant((long long)(((unsigned long long)exp.b << 32) | exp.a), i64), DataType::LONG);
+		case ExpressionType::ConstantString: return lower_string(app.strings[exp.a]);
+		}
+		throw std::exception("Unknown expression");
+	}
+
+	// statements
+
+	void find_address_taken(node_index e) {
+		if (e == NO_NODE) return;
+		const Expression& exp = app.expressions[e];
+		switch (exp.type) {
+		case ExpressionType::UnaryOperator:
+			if (exp.op == address && app.expressions[exp.a].type == ExpressionType::VariableRef) address_taken.insert(app.expressions[exp.a].a);
+			find_address_taken(exp.a);
+			break;
+		case ExpressionType::BinaryOperator:
+			find_address_taken(exp.a);
+			find_address_taken(exp.b);
+			break;
+		case ExpressionType::Ternary:
+			find_address_taken(exp.a);
+			find_address_taken(app.children[exp.b]);
+			find_address_taken(app.children[exp.b + 1]);
+			break;
+		case ExpressionType::FunctionCall:
+			find_address_taken(exp.a);
+			for (node_index i = 0; i < exp.op; i++) find_address_taken(app.children[exp.b + i]);
+			break;
+		case ExpressionType::MemberAccess:
+		case ExpressionType::PointerMemberAccess:
+			find_address_taken(exp.a);
+			break;
+		default:
+			break;
+		}
+	}
+
+	void find_address_taken_in_line(node_index l) {
+		if (l == NO_NODE) return;
+		const Line& line = app.lines[l];
+		switch (line.type) {
+		case LineType::Return:
+		case LineType::Expression:
+		case LineType::VariableDeclaration:
+			find_address_taken(line.a);
+			break;
+		case LineType::If:
+			find_address_taken(line.a);
+			find_address_taken_in_line(line.b);
+			find_address_taken_in_line(line.c);
+			break;
+		case LineType::Block:
+			for (node_index i = 0; i < line.b; i++) find_address_taken_in_line(app.children[line.a + i]);
+			break;
+		case LineType::For:
+			find_address_taken_in_line(line.a);
+			find_address_taken(line.b);
+			find_address_taken(app.children[line.c]);
+			find_address_taken_in_line(app.children[line.c + 1]);
+			break;
+		case LineType::While:
+		case LineType::DoWhile:
+			find_address_taken(line.a);
+			find_address_taken_in_line(line.b);
+			break;
+		default:
+			break;
+		}
+	}
+
+	// a variable of type holding v: a value, or memory if its address is taken
+	void add_variable(symbol name, const DataType& type, ir_value v) {
+		ir_variable var{ name, type, 0 };
+		if (address_taken.count(name)) {
+			var.address = emit(IrOp::Alloca, i64, NO_VALUE, NO_VALUE, 8);
+			emit(IrOp::Store, width(type), var.address, v);
+		}
+		else {
+			var.ssa = (unsigned int)ssa_widths.size();
+			ssa_widths.push_back(width(type));
+			write_variable(var.ssa, current, v);
+		}
+		variables.push_back(var);
+	}
+
+	void lower_variable_declaration(const Line& line) {
+		symbol name = line.b;
+		DataType type = app.types[line.c];
+		if (is_struct(type)) {
+			int bytes = size_of(type);
+			ir_value address = emit(IrOp::Alloca, i64, NO_VALUE, NO_VALUE, bytes);
+			ir_value zero = constant(0, i64);
+			for (int i = 0; i < bytes; i += 8) emit(IrOp::Store, i64, address, zero, i);
+			variables.push_back({ name, type, 0, address });
+			return;
+		}
+		ir_value v;
+		if (line.a == NO_NODE) v = constant(0, width(type));
+		else {
+			ir_lowered init = lower(line.a);
+			v = convert(read(init), init.type, type);
+		}
+		add_variable(name, type, v);
+	}
+
+	// continues at if_true when condition isn't 0 and at if_false when it is. && and || become
+	// a chain of branches and ! swaps the targets, so no 0 or 1 is ever computed for them, a
+	// constant jumps straight to its target, and a comparison is left for instruction
+	// selection to fuse with the branch
+	void lower_condition(node_index condition, unsigned int if_true, unsigned int if_false) {
+		const Expression& exp = app.expressions[condition];
+		if (exp.type == ExpressionType::BinaryOperator && (exp.op == logical_and || exp.op == logical_or)) {
+			unsigned int right = new_block();
+			if (exp.op == logical_and) lower_condition(exp.a, right, if_false);
+			else lower_condition(exp.a, if_true, right);
+			seal(right);
+			current = right;
+			lower_condition(exp.b, if_true, if_false);
+			return;
+		}
+		if (exp.type == ExpressionType::UnaryOperator && exp.op == logical_negation) {
+			lower_condition(exp.a, if_false, if_true);
+			return;
+		}
+		switch (exp.type) {
+		case ExpressionType::ConstantChar:
+		case ExpressionType::ConstantShort:
+		case ExpressionType::ConstantInt:
+		case ExpressionType::ConstantLong:
+			// only the long constants use b
+			jump(exp.a != 0 || (exp.type == ExpressionType::ConstantLong && exp.b != 0) ? if_true : if_false);
+			return;
+		default:
+			break;
+		}
+		ir_lowered v = lower(condition);
+		if (is_struct(v.type)) throw std::exception("Condition on a struct");
+		branch(read(v), if_true, if_false);
+	}
+
+	// loops are rotated: the condition is tested once on the way in and then at the bottom of
+	// every iteration, so an iteration takes a single branch. the way in goes through a
+	// preheader, an empty block that's the place for code hoisted out of the loop
+	void lower_loop(node_index initial, node_index condition, node_index post, node_index inner, bool test_first) {
+		size_t variable_count = variables.size();
+		if (initial != NO_NODE) lower_line(initial);
+		unsigned int preheader = new_block(), body = new_block(), next = new_block(), end = new_block();
+		if (test_first && condition != NO_NODE) lower_condition(condition, preheader, end);
+		else jump(preheader);
+		seal(preheader);
+		current = preheader;
+		jump(body);
+		current = body;
+		loops.push_back({ end, next });
+		lower_line(inner);
+		loops.pop_back();
+		jump(next);
+		seal(next);
+		current = next;
+		if (post != NO_NODE) lower(post);
+		if (condition != NO_NODE) lower_condition(condition, body, end);
+		else jump(body);
+		seal(body);
+		seal(end);
+		current = end;
+		variables.resize(variable_count);
+	}
+
+	void lower_line(node_index l) {
+		const Line& line = app.lines[l];
+		switch (line.type) {
+		case LineType::Return: {
+			IrInstr ret;
+			ret.op = IrOp::Ret;
+			if (line.a != NO_NODE) {
+				ir_lowered v = lower(line.a);
+				ret.a = read(v);
+				if (!is_struct(v.type) && return_type.id != 0) ret.a = convert(ret.a, v.type, return_type);
+			}
+			f->add(current, std::move(ret));
+			start_unreachable();
+			break;
+		}
+		case LineType::Expression:
+			if (line.a != NO_NODE) lower(line.a);
+			break;
+		case LineType::VariableDeclaration:
+			lower_variable_declaration(line);
+			break;
+		case LineType::If: {
+			unsigned int if_block = new_block(), else_block = line.c != NO_NODE ? new_block() : 0, end = new_block();
+			lower_condition(line.a, if_block, line.c != NO_NODE ? else_block : end);
+			seal(if_block);
+			current = if_block;
+			lower_line(line.b);
+			jump(end);
+			if (line.c != NO_NODE) {
+				seal(else_block);
+				current = else_block;
+				lower_line(line.c);
+				jump(end);
+			}
+			seal(end);
+			current = end;
+			break;
+		}
+		case LineType::Block: {
+			size_t variable_count = variables.size();
+			for (node_index i = 0; i < line.b; i++) lower_line(app.children[line.a + i]);
+			variables.resize(variable_count);
+			break;
+		}
+		case LineType::For:
+			lower_loop(line.a, line.b, app.children[line.c], app.children[line.c + 1], true);
+			break;
+		case LineType::While:
+			lower_loop(NO_NODE, line.a, NO_NODE, line.b, true);
+			break;
+		case LineType::DoWhile:
+			lower_loop(NO_NODE, line.a, NO_NODE, line.b, false);
+			break;
+		case LineType::Break:
+		case LineType::Continue:
+			if (loops.empty()) throw std::exception("break or continue outside of a loop");
+			jump(line.type == LineType::Break ? loops.back().break_target : loops.back().continue_target);
+			start_unreachable();
+			break;
+		}
+	}
+
+	void lower_function(const Function& function, ir_function& out) {
+		f = &out;
+		out.name = function.name;
+		out.params = (unsigned int)function.params.size();
+		variables.clear();
+		address_taken.clear();
+		ssa_widths.clear();
+		definitions.clear();
+		incomplete_phis.clear();
+		sealed.clear();
+		return_type = function.return_type;
+		find_address_taken_in_line(function.lines);
+
+		current = new_block();
+		seal(current);
+		for (size_t i = 0; i < function.params.size(); i++) {
+			const DataType& type = function.params[i].second;
+			ir_value param = emit(IrOp::Param, i64, NO_VALUE, NO_VALUE, (long long)i);
+			// struct parameters hold the address of the struct
+			if (is_struct(type)) variables.push_back({ function.params[i].first, type, 0, param });
+			else add_variable(function.params[i].first, type, convert(param, DataType::LONG, type));
+		}
+		lower_line(function.lines);
+		// falling off the end returns 0
+		IrInstr ret;
+		ret.op = IrOp::Ret;
+		ret.a = constant(0, return_type.id == 0 && return_type.pointers == 0 ? i64 : width(return_type));
+		f->add(current, std::move(ret));
+
+		remove_unreachable_blocks(out);
+		remove_trivial_phis(out);
+	}
+
+	void lower_application(std::vector<ir_function>& functions) {
+		std::vector<const Function*> bodies;
+		auto add_function = [&](const Function& f) {
+			declarations[f.name] = &f;
+			if (f.lines != NO_NODE) bodies.push_back(&f);
+		};
+		for (const Declaration& declaration : app.declarations) {
+			if (declaration.type == DeclarationType::Struct) {
+				const Struct& s = app.structs[declaration.index];
+				structs[s.id] = &s;
+				for (node_index f : s.functions) add_function(app.functions[f]);
+			}
+			else add_function(app.functions[declaration.index]);
+		}
+		functions.resize(bodies.size());
+		for (size_t i = 0; i < bodies.size(); i++) lower_function(*bodies[i], functions[i]);
+	}
+};
+
+void Application::generateIR(std::vector<ir_function>& functions) {
+	ir_lowering lowering(*this);
+	lowering.lower_application(functions);
+}
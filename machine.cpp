@@ -0,0 +1,185 @@
+#include "machine.h"
+#include <charconv>
+
+const char* mnemonics[] = {
+	"mov", "lea", "add", "sub", "imul", "idiv", "neg", "not", "inc", "dec", "cmp", "and", "or", "xor", "sal", "sar", "shr", "movs", "cqto",
+	"sete", "setne", "setl", "setg", "setle", "setge",
+	"push", "pop", "jmp", "je", "jne", "jl", "jg", "jle", "jge", "call", "ret",
+	"movdqu", "padd", "psub", "pand", "por", "pxor", "psrldq", "movq", "vextracti128", "vzeroupper"
+};
+
+// the suffix of Padd and Psub for each element size
+const char vector_suffixes[] = { 'b', 'w', 'd', 'q' };
+
+const char* label_prefixes[] = {
+	"_loc", "_loc_end", "_e3_if_", "_post_conditional_if_", "_e3_", "_post_conditional_",
+	"_while_start_", "_while_end_", "_do_while_start_", "_do_while_end_", "_for_start_", "_for_continue_", "_for_end_",
+	"_block_"
+};
+
+const reg call_clobbered[] = { rax, rcx, rdx, rsi, rdi, r8, r9, r10, r11 };
+
+void destination_role(const MachineInstr& in, bool& reads, bool& writes) {
+	switch (in.op) {
+	case Opcode::Mov: reads = in.s < i32; writes = true; return;
+	case Opcode::Lea:
+	case Opcode::Movsx:
+	case Opcode::Movq:
+	case Opcode::Pop: reads = false; writes = true; return;
+	case Opcode::Imul: reads = true; writes = in.src.type != OperandType::None; return;
+	case Opcode::Cmp:
+	case Opcode::Push:
+	case Opcode::Idiv:
+	case Opcode::Call: reads = true; writes = false; return;
+	case Opcode::Cqo:
+	case Opcode::Jmp:
+	case Opcode::Je:
+	case Opcode::Jne:
+	case Opcode::Jl:
+	case Opcode::Jg:
+	case Opcode::Jle:
+	case Opcode::Jge:
+	case Opcode::Ret:
+	case Opcode::Label:
+	case Opcode::Globl: reads = false; writes = false; return;
+	default: reads = true; writes = true; return;
+	}
+}
+
+void collect(const MachineInstr& in, register_access& a) {
+	if (in.src.type == OperandType::Register || in.src.type == OperandType::Memory) {
+		if (in.op != Opcode::Call) a.use(location(in.src));
+	}
+	if (in.dst.type == OperandType::Memory) a.use(location(in.dst));
+	else if (in.dst.type == OperandType::Register) {
+		bool reads, writes;
+		destination_role(in, reads, writes);
+		if (reads) a.use(location(in.dst));
+		if (writes) a.def(location(in.dst));
+	}
+	switch (in.op) {
+	case Opcode::Imul:
+		if (in.src.type != OperandType::None) break;
+		a.use(rax);
+		a.def(rax);
+		a.def(rdx);
+		break;
+	case Opcode::Idiv:
+		a.use(rax);
+		a.use(rdx);
+		a.def(rax);
+		a.def(rdx);
+		break;
+	case Opcode::Cqo:
+		a.use(rax);
+		a.def(rdx);
+		break;
+	case Opcode::Call:
+		for (int r = 0; r < REGISTER_COUNT; r++) {
+			if (in.src.value >> r & 1) a.use(r);
+		}
+		for (reg r : call_clobbered) a.def(r);
+		break;
+	case Opcode::Ret:
+		a.use(rax);
+		break;
+	default:
+		break;
+	}
+}
+
+inline void append_number(output_buffer& out, int value) {
+	char buffer[16];
+	out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr - buffer);
+}
+
+inline void append_register(output_buffer& out, const MachineOperand& o, size s) {
+	if (o.virt) {
+		out.append('v');
+		append_number(out, (int)o.virt);
+	}
+	else out.append(_register(o.r, s));
+}
+
+void append_operand(output_buffer& out, const MachineOperand& o) {
+	switch (o.type) {
+	case OperandType::None:
+		break;
+	case OperandType::Register:
+		out.append('%');
+		append_register(out, o, o.s);
+		break;
+	case OperandType::Memory:
+		if (o.value) append_number(out, o.value);
+		out.append("(%");
+		append_register(out, o, i64);
+		out.append(')');
+		break;
+	case OperandType::Immediate:
+		out.append('$');
+		append_number(out, o.value);
+		break;
+	case OperandType::Label:
+		out.append(label_prefixes[(int)o.label]);
+		append_number(out, o.value);
+		break;
+	case OperandType::Symbol:
+		out.append(symbol_name(o.value));
+		break;
+	case OperandType::SymbolAddress:
+		out.append('$');
+		out.append(symbol_name(o.value));
+		break;
+	case OperandType::Xmm:
+	case OperandType::Ymm:
+		out.append(o.type == OperandType::Xmm ? "%xmm" : "%ymm");
+		append_number(out, o.value);
+		break;
+	}
+}
+
+void format_instructions(const std::vector<MachineInstr>& code, output_buffer& out) {
+	for (const MachineInstr& in : code) {
+		if (in.op == Opcode::Label) {
+			append_operand(out, in.dst);
+			out.append(":\n");
+			continue;
+		}
+		if (in.op == Opcode::Globl) {
+			out.append(".globl ");
+			append_operand(out, in.dst);
+			out.append('\n');
+			continue;
+		}
+		out.append('\t');
+		// the AVX2 forms of vector instructions are the SSE ones with a v, and arithmetic
+		// takes dst as its first source
+		bool avx = (in.src.type == OperandType::Ymm || in.dst.type == OperandType::Ymm) && in.op != Opcode::Vextracti128;
+		if (avx) out.append('v');
+		out.append(mnemonics[(int)in.op]);
+		if (in.op == Opcode::Movsx) {
+			out.append(_suffix(in.s));
+			out.append('q');
+		}
+		else if (in.op < Opcode::Movsx) out.append(_suffix(in.s));
+		else if (in.op == Opcode::Padd || in.op == Opcode::Psub) out.append(vector_suffixes[in.s]);
+		if (in.op == Opcode::Vextracti128) out.append(" $1,");
+		if (in.src.type != OperandType::None && in.op != Opcode::Call) {
+			out.append(' ');
+			append_operand(out, in.src);
+			out.append(',');
+		}
+		if (avx && in.op >= Opcode::Padd && in.op <= Opcode::Pxor) {
+			out.append(' ');
+			append_operand(out, in.dst);
+			out.append(',');
+		}
+		if (in.dst.type != OperandType::None) {
+			out.append(' ');
+			// indirect calls and jumps go through a register
+			if (in.op == Opcode::Call && in.dst.type == OperandType::Register) out.append('*');
+			append_operand(out, in.dst);
+		}
+		out.append('\n');
+	}
+}
@@ -0,0 +1,184 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "intern.h"
+#include "output.h"
+#include "register.h"
+
+// codegen appends instruction records, and text is only produced once a whole function
+// has been generated
+
+// instructions before Sete take a size suffix. Movsx sign extends from its size to 64 bits
+// and Cqo sign extends rax into rdx, both always 64 bit. Imul without a src is the one
+// operand form, which multiplies rax by dst into rdx:rax. Call's src is an immediate with a
+// bit set for each register, by number, that holds an argument.
+// the vector instructions from Movdqu on work on xmm registers, or with ymm operands on ymm
+// ones in their AVX2 form. Padd and Psub add and subtract elements of their size, Psrldq
+// shifts dst right by src bytes, Movq moves the low 64 bits of an xmm register to a general
+// one and Vextracti128 the high half of a ymm register to an xmm one
+enum class Opcode : unsigned char {
+	Mov, Lea, Add, Sub, Imul, Idiv, Neg, Not, Inc, Dec, Cmp, And, Or, Xor, Sal, Sar, Shr, Movsx, Cqo,
+	Sete, Setne, Setl, Setg, Setle, Setge,
+	Push, Pop, Jmp, Je, Jne, Jl, Jg, Jle, Jge, Call, Ret,
+	Movdqu, Padd, Psub, Pand, Por, Pxor, Psrldq, Movq, Vextracti128, Vzeroupper,
+	Label, Globl // a label definition and a .globl directive
+};
+
+enum class OperandType : unsigned char {
+	None, Register, Memory, Immediate, Label, Symbol, SymbolAddress,
+	Xmm, Ymm // vector registers, numbered by value. register allocation leaves them alone
+};
+
+// the labels codegen makes, each numbered by the statement or operator it belongs to
+enum class LabelType : unsigned char {
+	Loc, LocEnd, IfElse, IfEnd, TernaryElse, TernaryEnd,
+	WhileStart, WhileEnd, DoWhileStart, DoWhileEnd, ForStart, ForContinue, ForEnd,
+	Block // a basic block of the SSA form
+};
+
+// value is the displacement of a Memory operand, the number of a Label, the name of a
+// Symbol or the Immediate itself. a SymbolAddress is the address of a symbol as an immediate.
+// codegen uses virtual registers, numbered from 1 in each function, in place of r until
+// register allocation replaces them
+struct MachineOperand {
+	OperandType type = OperandType::None;
+	reg r = rax; // Memory operands address through the 64 bit register
+	size s = i64;
+	LabelType label = LabelType::Loc;
+	int value = 0;
+	unsigned int virt = 0; // 0 for the physical register r
+};
+
+struct MachineInstr {
+	Opcode op = Opcode::Mov;
+	size s = i64;
+	MachineOperand src, dst; // instructions with one operand only have dst
+};
+
+constexpr MachineOperand register_operand(reg r, size s = i64) {
+	MachineOperand o;
+	o.type = OperandType::Register;
+	o.r = r;
+	o.s = s;
+	return o;
+}
+
+constexpr MachineOperand memory_operand(reg r, int displacement = 0) {
+	MachineOperand o;
+	o.type = OperandType::Memory;
+	o.r = r;
+	o.value = displacement;
+	return o;
+}
+
+constexpr MachineOperand virtual_operand(unsigned int virt, size s = i64) {
+	MachineOperand o = register_operand(rax, s);
+	o.virt = virt;
+	return o;
+}
+
+constexpr MachineOperand virtual_memory_operand(unsigned int virt, int displacement = 0) {
+	MachineOperand o = memory_operand(rax, displacement);
+	o.virt = virt;
+	return o;
+}
+
+constexpr MachineOperand vector_operand(int number, bool ymm = false) {
+	MachineOperand o;
+	o.type = ymm ? OperandType::Ymm : OperandType::Xmm;
+	o.value = number;
+	return o;
+}
+
+constexpr MachineOperand immediate_operand(int value) {
+	MachineOperand o;
+	o.type = OperandType::Immediate;
+	o.value = value;
+	return o;
+}
+
+constexpr MachineOperand label_operand(LabelType label, int number) {
+	MachineOperand o;
+	o.type = OperandType::Label;
+	o.label = label;
+	o.value = number;
+	return o;
+}
+
+constexpr MachineOperand symbol_operand(symbol name) {
+	MachineOperand o;
+	o.type = OperandType::Symbol;
+	o.value = name;
+	return o;
+}
+
+constexpr MachineOperand symbol_address_operand(symbol name) {
+	MachineOperand o = symbol_operand(name);
+	o.type = OperandType::SymbolAddress;
+	return o;
+}
+
+constexpr MachineInstr machine_instr(Opcode op, size s, MachineOperand src, MachineOperand dst) {
+	MachineInstr in;
+	in.op = op;
+	in.s = s;
+	in.src = src;
+	in.dst = dst;
+	return in;
+}
+
+inline bool is_conditional_jump(Opcode op) {
+	return op >= Opcode::Je && op <= Opcode::Jge;
+}
+
+inline bool ends_block(Opcode op) {
+	return op == Opcode::Jmp || is_conditional_jump(op) || op == Opcode::Ret;
+}
+
+// locations number the physical registers first and the virtual ones after them
+inline int location(const MachineOperand& o) {
+	return o.virt ? REGISTER_COUNT + (int)o.virt : o.r;
+}
+
+inline bool is_virtual(int location) {
+	return location >= REGISTER_COUNT;
+}
+
+// the locations an instruction reads and writes, leaving out rsp and rbp
+struct register_access {
+	int uses[8];
+	int defs[REGISTER_COUNT];
+	int use_count = 0, def_count = 0;
+
+	void use(int l) {
+		if (l != rsp && l != rbp) uses[use_count++] = l;
+	}
+
+	void def(int l) {
+		if (l != rsp && l != rbp) defs[def_count++] = l;
+	}
+
+	bool uses_location(int l) const {
+		for (int i = 0; i < use_count; i++) {
+			if (uses[i] == l) return true;
+		}
+		return false;
+	}
+
+	bool defines(int l) const {
+		for (int i = 0; i < def_count; i++) {
+			if (defs[i] == l) return true;
+		}
+		return false;
+	}
+};
+
+// whether an instruction reads and writes its destination when that's a register. writing
+// less than 32 bits keeps the rest of the register, so it's a read too
+void destination_role(const MachineInstr& in, bool& reads, bool& writes);
+
+// the registers in, a call clobbering the caller-saved ones, reads and writes
+void collect(const MachineInstr& in, register_access& a);
+
+// AT&T syntax, one instruction per line. virtual registers are written %v1, %v2 and so on
+void format_instructions(const std::vector<MachineInstr>& code, output_buffer& out);
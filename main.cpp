@@ -1,29 +1,107 @@
+#include <chrono>
 #include <iostream>
-#include <sstream>
 #include <fstream>
+#include <string>
 #include <vector>
 
+#include "source.h"
 #include "tokenize.h"
 #include "ast.h"
+#include "output.h"
+#include "jit.h"
+#include "vm.h"
+#include "ir.h"
 
-std::string slurp(std::ifstream& in) {
-	std::ostringstream sstr;
-	sstr << in.rdbuf();
-	return sstr.str();
-}
-
+// compiler [-S] source output
+//   writes an ELF object file, or assembly text with -S. both call the System V way, so
+//   they link against the C library on Linux, except that text on Windows calls the Windows
+//   way. the JIT always does, and goes through stubs to reach the C library elsewhere
+// compiler -jit source [entry]
+//   runs entry, main by default, in this process and exits with what it returns
+// compiler -vm source [entry]
+//   the same, running bytecode in an interpreter instead of machine code
+// compiler -ir source output
+//   writes the SSA form of every function
+// options before the source tune machine code:
+//   -no-peephole          turns every peephole rule off
+//   -no-peephole=rule     turns one off, by its name in peephole.cpp
+//   -peephole-stats       lists what each rule removed on stderr
+//   -avx2                 vectorizes loops with AVX2 rather than SSE2, for machines that have it
 int main(int argc, char* argv[]) {
-	initAST();
-
-	std::ifstream openfile = std::ifstream(argv[1]);
-	std::string s = slurp(openfile);
-	std::queue<token> token_queue;
-	tokenize(s, token_queue);
-	assembly ass;
-	Application* ast = compile_application(token_queue);
-	ast->generateAssembly(ass);
-	//std::cout << ass.str() << std::endl;
-	std::ofstream outfile = std::ofstream(argv[2]);
-	outfile << ass.str();
-	outfile.close();
+	auto start = std::chrono::steady_clock::now();
+	bool text = false, jit = false, vm = false, ir = false, statistics = false, avx2 = false;
+	peephole_optimizer peephole;
+	for (; argc > 1 && argv[1][0] == '-'; argv++, argc--) {
+		std::string option = argv[1];
+		if (option == "-S") text = true;
+		else if (option == "-jit") jit = true;
+		else if (option == "-vm") vm = true;
+		else if (option == "-ir") ir = true;
+		else if (option == "-peephole-stats") statistics = true;
+		else if (option == "-avx2") avx2 = true;
+		else if (option == "-no-peephole") peephole.enabled.assign(PEEPHOLE_RULE_COUNT, false);
+		else if (option.rfind("-no-peephole=", 0) == 0) {
+			if (!peephole.enable(option.c_str() + 13, false)) throw std::exception("Unknown peephole rule");
+		}
+		else throw std::exception("Unknown option");
+	}
+	source_buffer source(argv[1]);
+	std::vector<token> lexed;
+	if (source.view().size() >= PARALLEL_TOKENIZE_SIZE) tokenize(source.view(), lexed);
+	token_stream tokens = lexed.empty() ? token_stream(source.view()) : token_stream(lexed);
+	Application ast = compile_application(tokens);
+	ast.fold_constants();
+	if (vm) {
+		bytecode_program program;
+		ast.generateBytecode(program);
+		const char* entry_name = argc > 2 ? argv[2] : "main";
+		int entry = program.find_function(intern(entry_name));
+		if (entry < 0) throw std::exception("Entry point not found");
+		return (int)run_bytecode(program, entry);
+	}
+	if (jit) {
+		object_file obj;
+		assembly ass(obj);
+		ass.peephole = &peephole;
+		ass.avx2 = avx2;
+		ast.generateAssembly(ass);
+		if (statistics) peephole.report(std::cerr);
+		jit_image image(obj);
+		const char* entry_name = argc > 2 ? argv[2] : "main";
+		auto entry = (long long (*)())image.address(intern(entry_name));
+		if (!entry) throw std::exception("Entry point not found");
+		std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - start;
+		std::cerr << "jit: " << entry_name << " ready after " << latency.count() << " ms" << std::endl;
+		return (int)entry();
+	}
+	output_buffer outfile(argv[2]);
+	if (ir) {
+		std::vector<ir_function> functions;
+		ast.generateIR(functions);
+		for (ir_function& f : functions) {
+			optimize(f);
+			verify(f);
+			dump(f, outfile);
+		}
+	}
+	else if (text) {
+		assembly ass(outfile);
+		ass.peephole = &peephole;
+		ass.avx2 = avx2;
+#ifndef _WIN32
+		ass.system_v = true;
+#endif
+		ast.generateAssembly(ass);
+	}
+	else {
+		object_file obj;
+		assembly ass(obj);
+		ass.peephole = &peephole;
+		ass.avx2 = avx2;
+		ass.system_v = true; // the object is ELF, to be linked on Linux
+		ast.generateAssembly(ass);
+		write_object(obj, outfile);
+	}
+	if (statistics) peephole.report(std::cerr);
+	outfile.flush();
 }
\ No newline at end of file
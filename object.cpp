@@ -0,0 +1,199 @@
+#include "object.h"
+#include <string>
+
+// the ELF structures are written as they're laid out in memory, which matches the file
+// format on a little endian host
+
+struct elf_header {
+	unsigned char ident[16];
+	unsigned short type;
+	unsigned short machine;
+	unsigned int version;
+	unsigned long long entry;
+	unsigned long long program_header_offset;
+	unsigned long long section_header_offset;
+	unsigned int flags;
+	unsigned short header_size;
+	unsigned short program_header_size;
+	unsigned short program_header_count;
+	unsigned short section_header_size;
+	unsigned short section_header_count;
+	unsigned short section_names_index;
+};
+
+struct elf_section_header {
+	unsigned int name;
+	unsigned int type;
+	unsigned long long flags;
+	unsigned long long address;
+	unsigned long long offset;
+	unsigned long long size;
+	unsigned int link;
+	unsigned int info;
+	unsigned long long alignment;
+	unsigned long long entry_size;
+};
+
+struct elf_symbol {
+	unsigned int name;
+	unsigned char info;
+	unsigned char other;
+	unsigned short section;
+	unsigned long long value;
+	unsigned long long size;
+};
+
+struct elf_relocation {
+	unsigned long long offset;
+	unsigned long long info;
+	long long addend;
+};
+
+const unsigned short ET_REL = 1;
+const unsigned short EM_X86_64 = 62;
+
+const unsigned int SHT_PROGBITS = 1;
+const unsigned int SHT_SYMTAB = 2;
+const unsigned int SHT_STRTAB = 3;
+const unsigned int SHT_RELA = 4;
+
+const unsigned long long SHF_WRITE = 0x1;
+const unsigned long long SHF_ALLOC = 0x2;
+const unsigned long long SHF_EXECINSTR = 0x4;
+const unsigned long long SHF_INFO_LINK = 0x40;
+
+const unsigned char STB_LOCAL = 0;
+const unsigned char STB_GLOBAL = 1;
+const unsigned char STT_NOTYPE = 0;
+const unsigned char STT_FUNC = 2;
+const unsigned char STT_SECTION = 3;
+
+const unsigned int R_X86_64_32S = 11;
+const unsigned int R_X86_64_PLT32 = 4;
+
+// the sections in the order of their headers
+enum section_index : unsigned short {
+	null_section, text_section, rodata_section, data_section, symtab_section, strtab_section,
+	rela_text_section, note_section, shstrtab_section, section_count
+};
+
+unsigned int object_file::symbol_index(symbol name) {
+	if (indices.size() <= (size_t)name) indices.resize(name + 1, ~0u);
+	if (indices[name] == ~0u) {
+		indices[name] = (unsigned int)symbols.size();
+		object_symbol s;
+		s.name = name;
+		symbols.push_back(s);
+	}
+	return indices[name];
+}
+
+const object_symbol* object_file::find_symbol(symbol name) const {
+	if (indices.size() <= (size_t)name || indices[name] == ~0u) return nullptr;
+	return &symbols[indices[name]];
+}
+
+unsigned long long align(unsigned long long offset, unsigned long long alignment) {
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+template<typename T>
+void append_struct(output_buffer& out, const T& value) {
+	out.append((const char*)&value, sizeof(T));
+}
+
+void write_object(const object_file& obj, output_buffer& out) {
+	// locals have to come before globals in the symbol table. the first entry is the null
+	// symbol, followed by one for each section relocations could refer to
+	std::vector<elf_symbol> symbols(4);
+	std::vector<unsigned int> elf_index(obj.symbols.size());
+	std::string strings(1, '\0');
+	for (int i = 1; i <= 3; i++) {
+		symbols[i].info = STT_SECTION;
+		symbols[i].section = (unsigned short)i;
+	}
+	unsigned int first_global = 0;
+	for (int pass = 0; pass < 2; pass++) {
+		if (pass == 1) first_global = (unsigned int)symbols.size();
+		for (size_t i = 0; i < obj.symbols.size(); i++) {
+			const object_symbol& s = obj.symbols[i];
+			// anything not defined here has to be found by the linker
+			bool global = s.global || !s.defined;
+			if (global != (pass == 1)) continue;
+			elf_symbol e = {};
+			e.name = (unsigned int)strings.size();
+			e.info = (unsigned char)((global ? STB_GLOBAL : STB_LOCAL) << 4 | (s.defined ? STT_FUNC : STT_NOTYPE));
+			e.section = s.defined ? text_section : null_section;
+			e.value = s.offset;
+			strings += symbol_name(s.name);
+			strings += '\0';
+			elf_index[i] = (unsigned int)symbols.size();
+			symbols.push_back(e);
+		}
+	}
+
+	std::vector<elf_relocation> relocations;
+	relocations.reserve(obj.relocations.size());
+	for (const relocation& r : obj.relocations) {
+		unsigned int type = r.type == RelocationType::Call ? R_X86_64_PLT32 : R_X86_64_32S;
+		relocations.push_back({ r.offset, (unsigned long long)elf_index[r.symbol] << 32 | type, r.addend });
+	}
+
+	const char* section_names[section_count] = {
+		"", ".text", ".rodata", ".data", ".symtab", ".strtab", ".rela.text", ".note.GNU-stack", ".shstrtab"
+	};
+	std::string names;
+	elf_section_header headers[section_count] = {};
+	for (int i = 0; i < section_count; i++) {
+		headers[i].name = (unsigned int)names.size();
+		names += section_names[i];
+		names += '\0';
+	}
+
+	headers[text_section] = { headers[text_section].name, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 0, 0, obj.text.size(), 0, 0, 16, 0 };
+	headers[rodata_section] = { headers[rodata_section].name, SHT_PROGBITS, SHF_ALLOC, 0, 0, obj.rodata.size(), 0, 0, 8, 0 };
+	headers[data_section] = { headers[data_section].name, SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, 0, 0, obj.data.size(), 0, 0, 8, 0 };
+	headers[symtab_section] = { headers[symtab_section].name, SHT_SYMTAB, 0, 0, 0, symbols.size() * sizeof(elf_symbol), strtab_section, first_global, 8, sizeof(elf_symbol) };
+	headers[strtab_section] = { headers[strtab_section].name, SHT_STRTAB, 0, 0, 0, strings.size(), 0, 0, 1, 0 };
+	headers[rela_text_section] = { headers[rela_text_section].name, SHT_RELA, SHF_INFO_LINK, 0, 0, relocations.size() * sizeof(elf_relocation), symtab_section, text_section, 8, sizeof(elf_relocation) };
+	// an empty .note.GNU-stack tells the linker the code doesn't need an executable stack
+	headers[note_section] = { headers[note_section].name, SHT_PROGBITS, 0, 0, 0, 0, 0, 0, 1, 0 };
+	headers[shstrtab_section] = { headers[shstrtab_section].name, SHT_STRTAB, 0, 0, 0, names.size(), 0, 0, 1, 0 };
+
+	// the sections follow the file header in order, and the section headers come last
+	unsigned long long offset = sizeof(elf_header);
+	for (int i = 1; i < section_count; i++) {
+		offset = align(offset, headers[i].alignment);
+		headers[i].offset = offset;
+		offset += headers[i].size;
+	}
+	unsigned long long section_header_offset = align(offset, 8);
+
+	elf_header header = {};
+	const unsigned char ident[] = { 0x7f, 'E', 'L', 'F', 2, 1, 1 }; // 64 bit, little endian, version 1
+	for (size_t i = 0; i < sizeof(ident); i++) header.ident[i] = ident[i];
+	header.type = ET_REL;
+	header.machine = EM_X86_64;
+	header.version = 1;
+	header.section_header_offset = section_header_offset;
+	header.header_size = sizeof(elf_header);
+	header.section_header_size = sizeof(elf_section_header);
+	header.section_header_count = section_count;
+	header.section_names_index = shstrtab_section;
+
+	const char* contents[section_count] = {
+		nullptr, (const char*)obj.text.data(), (const char*)obj.rodata.data(), (const char*)obj.data.data(),
+		(const char*)symbols.data(), strings.data(), (const char*)relocations.data(), nullptr, names.data()
+	};
+	const char zeros[16] = {};
+
+	append_struct(out, header);
+	offset = sizeof(elf_header);
+	for (int i = 1; i < section_count; i++) {
+		out.append(zeros, headers[i].offset - offset);
+		if (headers[i].size) out.append(contents[i], headers[i].size);
+		offset = headers[i].offset + headers[i].size;
+	}
+	out.append(zeros, section_header_offset - offset);
+	for (const elf_section_header& h : headers) append_struct(out, h);
+}
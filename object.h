@@ -0,0 +1,44 @@
+#pragma once
+#include <vector>
+#include "intern.h"
+#include "output.h"
+
+// the contents of a relocatable object file: the bytes of each section, the symbols code
+// defines or refers to, and the places in .text the linker has to fill in
+
+enum class RelocationType : unsigned char {
+	Call,      // a 32 bit displacement to a function, through the PLT if it's in a shared library
+	Absolute32 // a 32 bit sign extended address
+};
+
+struct object_symbol {
+	symbol name;
+	bool defined = false;
+	bool global = false;
+	unsigned int offset = 0; // in .text
+	int arguments = 0; // the most any call to it passes
+};
+
+struct relocation {
+	unsigned int offset; // in .text
+	unsigned int symbol; // index in symbols
+	RelocationType type;
+	int addend;
+};
+
+struct object_file {
+	std::vector<unsigned char> text, rodata, data;
+	std::vector<object_symbol> symbols;
+	std::vector<relocation> relocations;
+
+	// the index of name in symbols, added the first time it's used
+	unsigned int symbol_index(symbol name);
+	// nullptr if name isn't used
+	const object_symbol* find_symbol(symbol name) const;
+
+private:
+	std::vector<unsigned int> indices; // by symbol
+};
+
+// an ELF64 relocatable object for x86-64
+void write_object(const object_file& obj, output_buffer& out);
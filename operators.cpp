@@ -0,0 +1,240 @@
+#include "operators.h"
+
+// char, short, int and long with up to one pointer, as rvalues or lvalues. the order
+// matches DataType ids 1 to 4
+const int TYPE_SLOTS = 16;
+const int BINARY_OPERATORS = xor_assign + 1;
+const int UNARY_OPERATORS = dereference + 1;
+const int INSTRUCTION_POOL_SIZE = 1024;
+
+inline int type_slot(const DataType& t) {
+	if (t.id < 1 || t.id > 4 || t.pointers < 0 || t.pointers > 1) return -1;
+	return ((t.id - 1) * 2 + t.pointers) * 2 + t.lvalue;
+}
+
+constexpr int normal(int i) { return i * 4; }
+constexpr int lvalue(int i) { return i * 4 + 1; }
+constexpr int pointer(int i) { return i * 4 + 2; }
+constexpr int lvalue_pointer(int i) { return i * 4 + 3; }
+
+// the code of an operator is written over three virtual registers that emit() replaces:
+// the left operand, which also receives the result, the right operand and a temporary
+constexpr MachineOperand lhs(size s) { return virtual_operand(TEMPLATE_LEFT, s); }
+constexpr MachineOperand rhs(size s) { return virtual_operand(TEMPLATE_RIGHT, s); }
+constexpr MachineOperand tmp(size s) { return virtual_operand(TEMPLATE_TEMP, s); }
+// an lvalue, which is memory or the register of a variable
+constexpr MachineOperand lhs_memory() { return virtual_memory_operand(TEMPLATE_LEFT); }
+
+constexpr MachineInstr op(Opcode opcode, size s, MachineOperand src, MachineOperand dst) {
+	return machine_instr(opcode, s, src, dst);
+}
+
+constexpr MachineInstr op(Opcode opcode, size s, int src, MachineOperand dst) {
+	return machine_instr(opcode, s, immediate_operand(src), dst);
+}
+
+constexpr MachineInstr op(Opcode opcode, size s, MachineOperand dst) {
+	return machine_instr(opcode, s, MachineOperand(), dst);
+}
+
+// src sign extended to 64 bits in dst
+constexpr MachineInstr extend(size s, MachineOperand src, MachineOperand dst) {
+	return machine_instr(s == i64 ? Opcode::Mov : Opcode::Movsx, s, src, dst);
+}
+
+struct operator_tables {
+	MachineInstr pool[INSTRUCTION_POOL_SIZE] = {};
+	int pool_size = 0;
+	operator_code binary[TYPE_SLOTS][BINARY_OPERATORS][TYPE_SLOTS] = {};
+	operator_code unary[TYPE_SLOTS][UNARY_OPERATORS] = {};
+
+	constexpr operator_code add_code(int result, std::initializer_list<MachineInstr> code) {
+		if (pool_size + code.size() > INSTRUCTION_POOL_SIZE) throw "operator code doesn't fit, increase INSTRUCTION_POOL_SIZE";
+		operator_code c;
+		c.defined = true;
+		c.result = (unsigned char)result;
+		c.length = (unsigned char)code.size();
+		c.first = (unsigned short)pool_size;
+		for (const MachineInstr& in : code) pool[pool_size++] = in;
+		return c;
+	}
+
+	constexpr void add_binary(int type1, binary_operator op, int type2, int result, std::initializer_list<MachineInstr> code) {
+		binary[type1][op][type2] = add_code(result, code);
+	}
+
+	constexpr void add_unary(int type1, unary_operator op, int result, std::initializer_list<MachineInstr> code) {
+		unary[type1][op] = add_code(result, code);
+	}
+
+	constexpr operator_tables() {
+		size sizes[] = { i8, i16, i32, i64 };
+		Opcode comparisons[] = { Opcode::Sete, Opcode::Setne, Opcode::Setl, Opcode::Setg, Opcode::Setle, Opcode::Setge };
+
+		for (int i = 0; i < 4; i++) {
+			size s = sizes[i];
+			// imul has no 8 bit form, and the low byte of a wider product is the same
+			size ms = s == i8 ? i32 : s;
+			add_binary(normal(i), add, normal(i), normal(i), {
+				op(Opcode::Add, s, rhs(s), lhs(s)) });
+			add_binary(normal(i), subtract, normal(i), normal(i), {
+				op(Opcode::Sub, s, rhs(s), lhs(s)) });
+			add_binary(normal(i), multiply, normal(i), normal(i), {
+				op(Opcode::Imul, ms, rhs(ms), lhs(ms)) });
+			// division is done on 64 bits, where every narrower quotient fits
+			add_binary(normal(i), divide, normal(i), normal(i), {
+				extend(s, lhs(s), register_operand(rax)), extend(s, rhs(s), tmp(i64)), op(Opcode::Cqo, i64, MachineOperand()),
+				op(Opcode::Idiv, i64, tmp(i64)), op(Opcode::Mov, i64, register_operand(rax), lhs(i64)) });
+			add_binary(normal(i), mod, normal(i), normal(i), {
+				extend(s, lhs(s), register_operand(rax)), extend(s, rhs(s), tmp(i64)), op(Opcode::Cqo, i64, MachineOperand()),
+				op(Opcode::Idiv, i64, tmp(i64)), op(Opcode::Mov, i64, register_operand(rdx), lhs(i64)) });
+
+			for (int c = 0; c < 6; c++) {
+				add_binary(normal(i), (binary_operator)(equal + c), normal(i), normal(i), {
+					op(Opcode::Cmp, s, rhs(s), lhs(s)), op(Opcode::Mov, s, 0, lhs(s)), op(comparisons[c], i8, lhs(i8)) });
+			}
+
+			add_binary(normal(i), left_shift, normal(i), normal(i), {
+				op(Opcode::Mov, i64, rhs(i64), register_operand(rcx)), op(Opcode::Sal, s, register_operand(rcx, i8), lhs(s)) });
+			add_binary(normal(i), right_shift, normal(i), normal(i), {
+				op(Opcode::Mov, i64, rhs(i64), register_operand(rcx)), op(Opcode::Sar, s, register_operand(rcx, i8), lhs(s)) });
+
+			add_binary(normal(i), bitwise_xor, normal(i), normal(i), {
+				op(Opcode::Xor, s, rhs(s), lhs(s)) });
+			add_binary(normal(i), bitwise_or, normal(i), normal(i), {
+				op(Opcode::Or, s, rhs(s), lhs(s)) });
+			add_binary(normal(i), bitwise_and, normal(i), normal(i), {
+				op(Opcode::And, s, rhs(s), lhs(s)) });
+		}
+
+		for (int i = 0; i < 4; i++) {
+			size s = sizes[i];
+			size ms = s == i8 ? i32 : s;
+
+			add_binary(lvalue_pointer(i), assignment, pointer(i), lvalue_pointer(i), {
+				op(Opcode::Mov, i64, rhs(i64), lhs_memory()) });
+
+			add_binary(lvalue(i), assignment, normal(i), lvalue(i), {
+				op(Opcode::Mov, s, rhs(s), lhs_memory()) });
+			add_binary(lvalue(i), add_assign, normal(i), lvalue(i), {
+				op(Opcode::Add, s, rhs(s), lhs_memory()) });
+			add_binary(lvalue(i), subtract_assign, normal(i), lvalue(i), {
+				op(Opcode::Sub, s, rhs(s), lhs_memory()) });
+			// imul, like division, can't write memory
+			add_binary(lvalue(i), multiply_assign, normal(i), lvalue(i), {
+				extend(s, lhs_memory(), tmp(i64)), op(Opcode::Imul, ms, rhs(ms), tmp(ms)), op(Opcode::Mov, s, tmp(s), lhs_memory()) });
+			add_binary(lvalue(i), divide_assign, normal(i), lvalue(i), {
+				extend(s, lhs_memory(), register_operand(rax)), extend(s, rhs(s), tmp(i64)), op(Opcode::Cqo, i64, MachineOperand()),
+				op(Opcode::Idiv, i64, tmp(i64)), op(Opcode::Mov, s, register_operand(rax, s), lhs_memory()) });
+			add_binary(lvalue(i), mod_assign, normal(i), lvalue(i), {
+				extend(s, lhs_memory(), register_operand(rax)), extend(s, rhs(s), tmp(i64)), op(Opcode::Cqo, i64, MachineOperand()),
+				op(Opcode::Idiv, i64, tmp(i64)), op(Opcode::Mov, s, register_operand(rdx, s), lhs_memory()) });
+
+			add_binary(lvalue(i), left_shift_assign, normal(i), lvalue(i), {
+				op(Opcode::Mov, i64, rhs(i64), register_operand(rcx)), op(Opcode::Sal, s, register_operand(rcx, i8), lhs_memory()) });
+			add_binary(lvalue(i), right_shift_assign, normal(i), lvalue(i), {
+				op(Opcode::Mov, i64, rhs(i64), register_operand(rcx)), op(Opcode::Sar, s, register_operand(rcx, i8), lhs_memory()) });
+
+			add_binary(lvalue(i), xor_assign, normal(i), lvalue(i), {
+				op(Opcode::Xor, s, rhs(s), lhs_memory()) });
+			add_binary(lvalue(i), or_assign, normal(i), lvalue(i), {
+				op(Opcode::Or, s, rhs(s), lhs_memory()) });
+			add_binary(lvalue(i), and_assign, normal(i), lvalue(i), {
+				op(Opcode::And, s, rhs(s), lhs_memory()) });
+		}
+
+		// operators that take an lvalue and result in an rvalue leave the result in the temporary
+		for (int i = 0; i < 4; i++) {
+			size s = sizes[i];
+			add_unary(normal(i), negation, normal(i), {
+				op(Opcode::Neg, s, lhs(s)) });
+			add_unary(normal(i), bitwise_complement, normal(i), {
+				op(Opcode::Not, s, lhs(s)) });
+			add_unary(normal(i), logical_negation, normal(i), {
+				op(Opcode::Cmp, s, 0, lhs(s)), op(Opcode::Mov, s, 0, lhs(s)), op(Opcode::Sete, i8, lhs(i8)) });
+
+			add_unary(lvalue(i), prefix_increment, lvalue(i), {
+				op(Opcode::Inc, s, lhs_memory()) });
+			add_unary(lvalue(i), prefix_decrement, lvalue(i), {
+				op(Opcode::Dec, s, lhs_memory()) });
+
+			add_unary(lvalue(i), postfix_increment, normal(i), {
+				extend(s, lhs_memory(), tmp(i64)), op(Opcode::Inc, s, lhs_memory()) });
+			add_unary(lvalue(i), postfix_decrement, normal(i), {
+				extend(s, lhs_memory(), tmp(i64)), op(Opcode::Dec, s, lhs_memory()) });
+
+			// pointers step by the size of what they point to
+			add_unary(lvalue_pointer(i), prefix_increment, lvalue_pointer(i), {
+				op(Opcode::Add, i64, 1 << i, lhs_memory()) });
+			add_unary(lvalue_pointer(i), prefix_decrement, lvalue_pointer(i), {
+				op(Opcode::Sub, i64, 1 << i, lhs_memory()) });
+
+			add_unary(lvalue_pointer(i), postfix_increment, pointer(i), {
+				op(Opcode::Mov, i64, lhs_memory(), tmp(i64)), op(Opcode::Add, i64, 1 << i, lhs_memory()) });
+			add_unary(lvalue_pointer(i), postfix_decrement, pointer(i), {
+				op(Opcode::Mov, i64, lhs_memory(), tmp(i64)), op(Opcode::Sub, i64, 1 << i, lhs_memory()) });
+		}
+		for (int i = 0; i < 4; i++) {
+			add_unary(lvalue(i), address, pointer(i), {});
+			add_unary(pointer(i), dereference, lvalue(i), {});
+		}
+		for (int i = 0; i < 4; i++) {
+			for (int j = 0; j < 4; j++) {
+				add_binary(pointer(i), add, normal(j), pointer(i), {
+					extend(sizes[j], rhs(sizes[j]), tmp(i64)), op(Opcode::Sal, i64, i, tmp(i64)), op(Opcode::Add, i64, tmp(i64), lhs(i64)) });
+				add_binary(pointer(i), subtract, normal(j), pointer(i), {
+					extend(sizes[j], rhs(sizes[j]), tmp(i64)), op(Opcode::Sal, i64, i, tmp(i64)), op(Opcode::Sub, i64, tmp(i64), lhs(i64)) });
+				add_binary(lvalue_pointer(i), add_assign, normal(j), lvalue_pointer(i), {
+					extend(sizes[j], rhs(sizes[j]), tmp(i64)), op(Opcode::Sal, i64, i, tmp(i64)), op(Opcode::Add, i64, tmp(i64), lhs_memory()) });
+				add_binary(lvalue_pointer(i), subtract_assign, normal(j), lvalue_pointer(i), {
+					extend(sizes[j], rhs(sizes[j]), tmp(i64)), op(Opcode::Sal, i64, i, tmp(i64)), op(Opcode::Sub, i64, tmp(i64), lhs_memory()) });
+			}
+			// comparing pointers results in an int
+			for (int c = 0; c < 6; c++) {
+				add_binary(pointer(i), (binary_operator)(equal + c), pointer(i), normal(2), {
+					op(Opcode::Cmp, i64, rhs(i64), lhs(i64)), op(Opcode::Mov, i32, 0, lhs(i32)), op(comparisons[c], i8, lhs(i8)) });
+			}
+		}
+	}
+};
+
+constexpr operator_tables operators;
+
+const operator_code* find_binary_operator(const DataType& left, binary_operator op, const DataType& right) {
+	int l = type_slot(left), r = type_slot(right);
+	if (l < 0 || r < 0) return nullptr;
+	const operator_code* code = &operators.binary[l][op][r];
+	return code->defined ? code : nullptr;
+}
+
+const operator_code* find_unary_operator(const DataType& left, unary_operator op) {
+	int l = type_slot(left);
+	if (l < 0) return nullptr;
+	const operator_code* code = &operators.unary[l][op];
+	return code->defined ? code : nullptr;
+}
+
+DataType result_type(const operator_code* code) {
+	if (!code) return DataType();
+	int slot = code->result;
+	size sizes[] = { i8, i16, i32, i64 };
+	return DataType(slot / 4 + 1, slot / 2 % 2, slot % 2, _bytes(sizes[slot / 4]));
+}
+
+MachineOperand instantiate(const MachineOperand& o, size s, const MachineOperand& left, const MachineOperand& right, unsigned int temp) {
+	switch (o.virt) {
+	case TEMPLATE_LEFT:
+		if (left.type == OperandType::Memory) return o.type == OperandType::Memory ? left : MachineOperand();
+		return virtual_operand(left.virt, o.type == OperandType::Memory ? s : o.s);
+	case TEMPLATE_RIGHT: return virtual_operand(right.virt, o.s);
+	case TEMPLATE_TEMP: return virtual_operand(temp, o.s);
+	default: return o;
+	}
+}
+
+void emit(const operator_code* code, assembly& ass, const MachineOperand& left, const MachineOperand& right, unsigned int temp) {
+	if (!code) return;
+	for (const MachineInstr* in = operators.pool + code->first; in != operators.pool + code->first + code->length; in++) {
+		ass.add(in->op, in->s, instantiate(in->src, in->s, left, right, temp), instantiate(in->dst, in->s, left, right, temp));
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "ast.h"
+
+// the code and result type of every operator on char, short, int and long values, pointers
+// to them, and lvalues of either. the tables are built at compile time and indexed directly
+// by the operand types, so looking an operator up is a few array reads
+
+struct operator_code {
+	bool defined = false;
+	unsigned char result = 0; // type slot of the result
+	unsigned char length = 0;
+	unsigned short first = 0; // in the instruction pool
+};
+
+// nullptr if the operator isn't defined for the operand types
+const operator_code* find_binary_operator(const DataType& left, binary_operator op, const DataType& right);
+const operator_code* find_unary_operator(const DataType& left, unary_operator op);
+
+// an undefined operator has no code and results in a default DataType
+DataType result_type(const operator_code* code);
+
+// the virtual registers operator code is written over
+const unsigned int TEMPLATE_LEFT = 1, TEMPLATE_RIGHT = 2, TEMPLATE_TEMP = 3;
+
+// appends the code with left, a virtual register or for an lvalue possibly memory, right,
+// a virtual register, and the virtual register temp in their places. the result is left,
+// except for operators from an lvalue to an rvalue, which leave it in temp
+void emit(const operator_code* code, assembly& ass, const MachineOperand& left, const MachineOperand& right, unsigned int temp);
@@ -0,0 +1,73 @@
+#include "output.h"
+
+output_buffer::output_buffer(const char* path)
+	: file(path, std::ios::binary) {
+	if (!file) throw std::exception("Could not open output file");
+	// whole chunks are written at a time, so the stream's own buffer would only add a copy
+	file.rdbuf()->pubsetbuf(nullptr, 0);
+}
+
+output_buffer::~output_buffer() {
+	if (file.is_open()) flush();
+}
+
+void output_buffer::append_chunked(const char* s, size_t length) {
+	while (length > space) {
+		if (space) memcpy(cursor, s, space);
+		s += space;
+		length -= space;
+		cursor += space;
+		space = 0;
+		next_chunk();
+	}
+	memcpy(cursor, s, length);
+	cursor += length;
+	space -= length;
+}
+
+// marks how much of the last chunk has been written into
+void output_buffer::seal() {
+	if (!chunks.empty()) chunks.back().used = CHUNK_SIZE - space;
+}
+
+void output_buffer::next_chunk() {
+	seal();
+	if (file.is_open() && !chunks.empty()) {
+		// a file only ever needs one chunk, which is written out and then reused
+		file.write(chunks.back().data.get(), chunks.back().used);
+	}
+	else {
+		chunks.push_back({ std::make_unique<char[]>(CHUNK_SIZE), 0 });
+	}
+	cursor = chunks.back().data.get();
+	space = CHUNK_SIZE;
+}
+
+void output_buffer::append(output_buffer&& other) {
+	other.seal();
+	for (chunk& c : other.chunks) {
+		if (c.used == 0) continue;
+		if (file.is_open()) {
+			// nothing is kept, so the text only needs copying into the file's chunk
+			append(c.data.get(), c.used);
+			continue;
+		}
+		// every chunk has the same capacity, so appending carries on in the last one moved
+		seal();
+		chunks.push_back(std::move(c));
+		cursor = chunks.back().data.get() + chunks.back().used;
+		space = CHUNK_SIZE - chunks.back().used;
+	}
+	other.chunks.clear();
+	other.cursor = nullptr;
+	other.space = 0;
+}
+
+void output_buffer::flush() {
+	if (!file.is_open() || chunks.empty()) return;
+	seal();
+	file.write(chunks.back().data.get(), chunks.back().used);
+	file.flush();
+	cursor = chunks.back().data.get();
+	space = CHUNK_SIZE;
+}
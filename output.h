@@ -0,0 +1,66 @@
+#pragma once
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// append-only text buffer kept in large chunks. a buffer opened on a file writes each chunk
+// out as soon as it fills, so the whole output is never held in memory, while an unopened
+// buffer keeps its chunks and can be moved onto the end of another buffer without copying
+struct output_buffer {
+	output_buffer() {
+	}
+	output_buffer(const char* path);
+	~output_buffer();
+
+	output_buffer(const output_buffer&) = delete;
+	output_buffer& operator=(const output_buffer&) = delete;
+
+	void append(const char* s, size_t length) {
+		if (length > space) {
+			append_chunked(s, length);
+			return;
+		}
+		memcpy(cursor, s, length);
+		cursor += length;
+		space -= length;
+	}
+
+	void append(const char* s) {
+		append(s, strlen(s));
+	}
+
+	void append(const std::string& s) {
+		append(s.data(), s.size());
+	}
+
+	void append(char c) {
+		if (space == 0) next_chunk();
+		*cursor++ = c;
+		space--;
+	}
+
+	// moves the contents of other to the end of this buffer, leaving other empty
+	void append(output_buffer&& other);
+
+	// writes everything appended so far to the file
+	void flush();
+
+private:
+	static const size_t CHUNK_SIZE = 1 << 20;
+
+	struct chunk {
+		std::unique_ptr<char[]> data;
+		size_t used;
+	};
+
+	std::vector<chunk> chunks;
+	char* cursor = nullptr;
+	size_t space = 0;
+	std::ofstream file;
+
+	void append_chunked(const char* s, size_t length);
+	void next_chunk();
+	void seal();
+};
@@ -0,0 +1,262 @@
+#include "peephole.h"
+
+// rules only ever look at physical registers: the code has been through register allocation.
+// whether a register is still needed is found by following the code forward from a point,
+// through labels and along both sides of jumps, until it's read or written, and giving up as
+// if it were read after a few dozen instructions
+
+const int SEARCH_LIMIT = 48;
+
+inline bool is_register(const MachineOperand& o) {
+	return o.type == OperandType::Register && !o.virt;
+}
+
+inline bool same_register(const MachineOperand& a, const MachineOperand& b) {
+	return is_register(a) && is_register(b) && a.r == b.r;
+}
+
+inline bool same_memory(const MachineOperand& a, const MachineOperand& b) {
+	return a.type == OperandType::Memory && b.type == OperandType::Memory && a.r == b.r && a.virt == b.virt && a.value == b.value;
+}
+
+inline bool refers_to(const MachineOperand& o, reg r) {
+	return (o.type == OperandType::Register || o.type == OperandType::Memory) && !o.virt && o.r == r;
+}
+
+// mov $k, %r of 32 or 64 bits
+inline bool is_constant_move(const MachineInstr& in) {
+	return in.op == Opcode::Mov && in.s >= i32 && in.src.type == OperandType::Immediate && is_register(in.dst);
+}
+
+size_t find_label(const std::vector<MachineInstr>& code, const MachineOperand& label) {
+	for (size_t i = 0; i < code.size(); i++) {
+		if (code[i].op == Opcode::Label && code[i].dst.type == OperandType::Label && code[i].dst.label == label.label && code[i].dst.value == label.value) return i;
+	}
+	return code.size();
+}
+
+bool read_after(const std::vector<MachineInstr>& code, size_t i, reg r, int& budget) {
+	for (size_t j = i + 1; j < code.size(); j++) {
+		if (budget-- <= 0) return true;
+		const MachineInstr& in = code[j];
+		if (in.op == Opcode::Jmp || is_conditional_jump(in.op)) {
+			size_t target = find_label(code, in.dst);
+			if (target == code.size() || read_after(code, target, r, budget)) return true;
+			if (in.op == Opcode::Jmp) return false;
+			continue;
+		}
+		register_access a;
+		collect(in, a);
+		if (a.uses_location(r)) return true;
+		if (a.defines(r) || in.op == Opcode::Ret) return false;
+	}
+	return true;
+}
+
+// whether r may be read after code[i]
+bool read_after(const std::vector<MachineInstr>& code, size_t i, reg r) {
+	int budget = SEARCH_LIMIT;
+	return read_after(code, i, r, budget);
+}
+
+// jmp L or jcc L straight before L
+bool jump_to_next(std::vector<MachineInstr>& code, size_t i) {
+	if (code[i].op != Opcode::Jmp && !is_conditional_jump(code[i].op)) return false;
+	for (size_t j = i + 1; j < code.size() && code[j].op == Opcode::Label; j++) {
+		if (code[j].dst.type == OperandType::Label && code[j].dst.label == code[i].dst.label && code[j].dst.value == code[i].dst.value) {
+			code.erase(code.begin() + i);
+			return true;
+		}
+	}
+	return false;
+}
+
+// anything between a jmp or ret and the next label
+bool unreachable(std::vector<MachineInstr>& code, size_t i) {
+	if (code[i].op != Opcode::Jmp && code[i].op != Opcode::Ret) return false;
+	size_t end = i + 1;
+	while (end < code.size() && code[end].op != Opcode::Label && code[end].op != Opcode::Globl) end++;
+	if (end == i + 1) return false;
+	code.erase(code.begin() + i + 1, code.begin() + end);
+	return true;
+}
+
+// mov %r, %r, except at 32 bits where it clears the top half
+bool self_move(std::vector<MachineInstr>& code, size_t i) {
+	const MachineInstr& in = code[i];
+	if (in.op != Opcode::Mov || in.s == i32 || !same_register(in.src, in.dst)) return false;
+	code.erase(code.begin() + i);
+	return true;
+}
+
+// mov %a, m; mov m, %b -> mov %a, m; mov %a, %b
+bool store_load(std::vector<MachineInstr>& code, size_t i) {
+	if (i + 1 >= code.size()) return false;
+	const MachineInstr& store = code[i];
+	MachineInstr& load = code[i + 1];
+	if (store.op != Opcode::Mov || load.op != Opcode::Mov || store.s != load.s || !is_register(store.src)
+		|| !same_memory(store.dst, load.src) || !is_register(load.dst)) return false;
+	load.src = register_operand(store.src.r, load.s);
+	return true;
+}
+
+// mov $k, %a; movsx %a, %b -> mov $k sign extended, %b
+bool constant_extension(std::vector<MachineInstr>& code, size_t i) {
+	if (i + 1 >= code.size()) return false;
+	const MachineInstr& constant = code[i];
+	const MachineInstr& extension = code[i + 1];
+	if (!is_constant_move(constant) || extension.op != Opcode::Movsx || extension.s == i64 || !same_register(constant.dst, extension.src)
+		|| !is_register(extension.dst)) return false;
+	int k = constant.src.value;
+	int value = extension.s == i8 ? (signed char)k : extension.s == i16 ? (short)k : k;
+	bool overwritten = extension.dst.r == constant.dst.r;
+	code[i + 1] = machine_instr(Opcode::Mov, i64, immediate_operand(value), register_operand(extension.dst.r));
+	if (overwritten) code.erase(code.begin() + i);
+	return true;
+}
+
+// mov $k, %a; ...; mov $k, %a with nothing writing %a in between
+bool repeated_constant(std::vector<MachineInstr>& code, size_t i) {
+	const MachineInstr& constant = code[i];
+	if (!is_constant_move(constant)) return false;
+	for (size_t j = i + 1; j < code.size() && j <= i + 4; j++) {
+		const MachineInstr& in = code[j];
+		if (in.op == Opcode::Label || ends_block(in.op) || in.op == Opcode::Call) return false;
+		if (in.op == Opcode::Mov && in.s == constant.s && in.src.type == OperandType::Immediate && in.src.value == constant.src.value
+			&& same_register(in.dst, constant.dst)) {
+			code.erase(code.begin() + j);
+			return true;
+		}
+		register_access a;
+		collect(in, a);
+		if (a.defines(constant.dst.r)) return false;
+	}
+	return false;
+}
+
+// mov $k, %a; ...; op %a, b -> ...; op $k, b when nothing in between touches %a and %a
+// isn't needed afterwards
+bool fold_immediate(std::vector<MachineInstr>& code, size_t i) {
+	const MachineInstr& constant = code[i];
+	if (!is_constant_move(constant)) return false;
+	reg r = constant.dst.r;
+	size_t j = i + 1;
+	for (; j < code.size() && j <= i + 3; j++) {
+		if (same_register(code[j].src, constant.dst)) break;
+		if (code[j].op == Opcode::Label || ends_block(code[j].op)) return false;
+		register_access a;
+		collect(code[j], a);
+		if (a.uses_location(r) || a.defines(r)) return false;
+	}
+	if (j >= code.size() || j > i + 3) return false;
+	MachineInstr& in = code[j];
+	if (refers_to(in.dst, r)) return false;
+	switch (in.op) {
+	case Opcode::Add: case Opcode::Sub: case Opcode::And: case Opcode::Or: case Opcode::Xor: case Opcode::Cmp:
+		break;
+	case Opcode::Imul:
+		if (!is_register(in.dst)) return false;
+		break;
+	default:
+		return false;
+	}
+	// the immediate is sign extended, where a 32 bit mov left the top half 0
+	if (in.s < i32 || (constant.s == i32 && in.s == i64 && constant.src.value < 0)) return false;
+	if (read_after(code, j, r)) return false;
+	in.src = constant.src;
+	code.erase(code.begin() + i);
+	return true;
+}
+
+inline Opcode jump_if(Opcode set, bool negate) {
+	switch (set) {
+	case Opcode::Sete: return negate ? Opcode::Jne : Opcode::Je;
+	case Opcode::Setne: return negate ? Opcode::Je : Opcode::Jne;
+	case Opcode::Setl: return negate ? Opcode::Jge : Opcode::Jl;
+	case Opcode::Setg: return negate ? Opcode::Jle : Opcode::Jg;
+	case Opcode::Setle: return negate ? Opcode::Jg : Opcode::Jle;
+	default: return negate ? Opcode::Jl : Opcode::Jge;
+	}
+}
+
+// cmp; mov $0, %a; setcc %a; cmp $0, %a; je/jne L -> cmp; jcc L when %a isn't needed afterwards
+bool compare_branch(std::vector<MachineInstr>& code, size_t i) {
+	if (i + 4 >= code.size() || code[i].op != Opcode::Cmp) return false;
+	const MachineInstr& clear = code[i + 1];
+	const MachineInstr& set = code[i + 2];
+	const MachineInstr& test = code[i + 3];
+	const MachineInstr& jump = code[i + 4];
+	if (!is_constant_move(clear) || clear.s != i32 || clear.src.value != 0) return false;
+	if (set.op < Opcode::Sete || set.op > Opcode::Setge || !same_register(set.dst, clear.dst)) return false;
+	if (test.op != Opcode::Cmp || test.s != i32 || test.src.type != OperandType::Immediate || test.src.value != 0 || !same_register(test.dst, clear.dst)) return false;
+	if (jump.op != Opcode::Je && jump.op != Opcode::Jne) return false;
+	if (read_after(code, i + 3, clear.dst.r)) return false;
+	MachineInstr fused = machine_instr(jump_if(set.op, jump.op == Opcode::Je), i64, MachineOperand(), jump.dst);
+	code.erase(code.begin() + i + 1, code.begin() + i + 5);
+	code.insert(code.begin() + i + 1, fused);
+	return true;
+}
+
+// mov %rbp, %rsp where nothing since the prologue moved rsp
+bool frame_restore(std::vector<MachineInstr>& code, size_t i) {
+	const MachineInstr& in = code[i];
+	if (in.op != Opcode::Mov || in.s != i64 || !is_register(in.src) || in.src.r != rbp || !is_register(in.dst) || in.dst.r != rsp) return false;
+	for (size_t j = i; j-- > 0;) {
+		const MachineInstr& m = code[j];
+		if (m.op == Opcode::Mov && is_register(m.src) && m.src.r == rsp && is_register(m.dst) && m.dst.r == rbp) {
+			code.erase(code.begin() + i);
+			return true;
+		}
+		// earlier epilogues end in a ret, so they don't lead here
+		if (m.op == Opcode::Pop && is_register(m.dst) && m.dst.r == rbp) continue;
+		if (m.op == Opcode::Mov && is_register(m.src) && m.src.r == rbp && is_register(m.dst) && m.dst.r == rsp) continue;
+		if (m.op == Opcode::Push || m.op == Opcode::Pop || (m.op != Opcode::Call && is_register(m.dst) && m.dst.r == rsp)) return false;
+	}
+	return false;
+}
+
+const peephole_rule peephole_rules[] = {
+	{ "unreachable", unreachable },
+	{ "jump-to-next", jump_to_next },
+	{ "self-move", self_move },
+	{ "store-load", store_load },
+	{ "constant-extension", constant_extension },
+	{ "repeated-constant", repeated_constant },
+	{ "immediate-operand", fold_immediate },
+	{ "compare-branch", compare_branch },
+	{ "frame-restore", frame_restore },
+};
+
+const size_t PEEPHOLE_RULE_COUNT = sizeof(peephole_rules) / sizeof(peephole_rules[0]);
+
+bool peephole_optimizer::enable(const char* name, bool on) {
+	for (size_t r = 0; r < PEEPHOLE_RULE_COUNT; r++) {
+		if (std::string(peephole_rules[r].name) != name) continue;
+		enabled[r] = on;
+		return true;
+	}
+	return false;
+}
+
+void peephole_optimizer::run(std::vector<MachineInstr>& code) {
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (size_t i = 0; i < code.size(); i++) {
+			for (size_t r = 0; r < PEEPHOLE_RULE_COUNT && i < code.size(); r++) {
+				if (!enabled[r]) continue;
+				size_t before = code.size();
+				if (!peephole_rules[r].apply(code, i)) continue;
+				matched[r]++;
+				removed[r] += before - code.size();
+				changed = true;
+			}
+		}
+	}
+}
+
+void peephole_optimizer::report(std::ostream& out) const {
+	for (size_t r = 0; r < PEEPHOLE_RULE_COUNT; r++) {
+		if (!matched[r]) continue;
+		out << "peephole: " << peephole_rules[r].name << " matched " << matched[r] << " times and removed " << removed[r] << " instructions" << std::endl;
+	}
+}
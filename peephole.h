@@ -0,0 +1,29 @@
+#pragma once
+#include <ostream>
+#include <vector>
+#include "machine.h"
+
+// rewrites of short instruction sequences in the code of a function once its registers are
+// allocated. each rule looks at the code from one instruction on and rewrites it in place if
+// it matches, and the rules run over the function again until none of them matches anywhere
+
+struct peephole_rule {
+	const char* name;
+	// rewrites code from i, true if it matched
+	bool (*apply)(std::vector<MachineInstr>& code, size_t i);
+};
+
+extern const peephole_rule peephole_rules[];
+extern const size_t PEEPHOLE_RULE_COUNT;
+
+struct peephole_optimizer {
+	std::vector<bool> enabled = std::vector<bool>(PEEPHOLE_RULE_COUNT, true); // by rule
+	std::vector<size_t> removed = std::vector<size_t>(PEEPHOLE_RULE_COUNT); // instructions each rule removed
+	std::vector<size_t> matched = std::vector<size_t>(PEEPHOLE_RULE_COUNT);
+
+	// turns the rule called name on or off, false if there's no such rule
+	bool enable(const char* name, bool on);
+	void run(std::vector<MachineInstr>& code);
+	// one line per rule that matched
+	void report(std::ostream& out) const;
+};
@@ -0,0 +1,318 @@
+#include "regalloc.h"
+#include <algorithm>
+#include <climits>
+#include <unordered_map>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// the registers values are given, in order of preference. the caller-saved ones come first
+// since they cost nothing in the prologue. rsi and rdi are last: calls may change them, as
+// System V functions do, and functions still save them, as Windows expects
+const reg allocatable[] = { rax, rcx, rdx, r8, r9, rbx, r12, r13, r14, r15, rsi, rdi };
+
+// spilled values are loaded into these around the instruction that uses them
+const reg SCRATCH_SOURCE = r11, SCRATCH_DESTINATION = r10;
+
+inline bool callee_saved(reg r) {
+	return r == rbx || r == rsi || r == rdi || r >= r12;
+}
+
+inline unsigned long long label_key(const MachineOperand& o) {
+	return (unsigned long long)o.label << 32 | (unsigned int)o.value;
+}
+
+inline int lowest_bit(unsigned long long bits) {
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long index;
+	_BitScanForward64(&index, bits);
+	return (int)index;
+#else
+	return __builtin_ctzll(bits);
+#endif
+}
+
+// a set of virtual registers
+struct register_set {
+	std::vector<unsigned long long> words;
+
+	register_set(unsigned int count = 0)
+		: words((count + 64) / 64) {
+	}
+
+	bool contains(unsigned int v) const { return words[v / 64] >> (v % 64) & 1; }
+	void insert(unsigned int v) { words[v / 64] |= 1ull << (v % 64); }
+
+	template <typename F>
+	void for_each(F f) const {
+		for (size_t w = 0; w < words.size(); w++) {
+			for (unsigned long long bits = words[w]; bits; bits &= bits - 1) {
+				f((unsigned int)(w * 64 + lowest_bit(bits)));
+			}
+		}
+	}
+};
+
+struct block {
+	int first, last; // instructions
+	std::vector<int> successors;
+	register_set uses, defs, live_in, live_out;
+};
+
+// instruction i reads at position 2i and writes at 2i + 1, so a value last read by an
+// instruction can share a register with the one it writes
+struct interval {
+	int start = INT_MAX, end = -1;
+
+	void extend(int position) {
+		start = std::min(start, position);
+		end = std::max(end, position);
+	}
+};
+
+// where physical registers are in use: between setting up and making a call, in division
+// and shifts, and where calls change them. ranges don't overlap and are sorted
+struct fixed_ranges {
+	std::vector<interval> ranges;
+
+	bool overlaps(const interval& i) const {
+		auto r = std::lower_bound(ranges.begin(), ranges.end(), i.start, [](const interval& r, int start) { return r.end < start; });
+		return r != ranges.end() && r->start <= i.end;
+	}
+};
+
+void allocate_registers(std::vector<MachineInstr>& code, size_t body, int locals, int outgoing) {
+	std::vector<MachineInstr> in(code.begin() + body, code.end());
+	code.erase(code.begin() + body, code.end());
+	int n = (int)in.size();
+
+	unsigned int virtual_count = 0;
+	for (const MachineInstr& i : in) virtual_count = std::max({ virtual_count, i.src.virt, i.dst.virt });
+
+	// basic blocks start at labels and after jumps
+	std::vector<block> blocks;
+	std::unordered_map<unsigned long long, int> label_blocks;
+	for (int i = 0; i < n; i++) {
+		if (blocks.empty() || in[i].op == Opcode::Label || ends_block(in[i - 1].op)) {
+			blocks.push_back({ i, i, std::vector<int>(), register_set(), register_set(), register_set(), register_set() });
+		}
+		blocks.back().last = i;
+		if (in[i].op == Opcode::Label) label_blocks[label_key(in[i].dst)] = (int)blocks.size() - 1;
+	}
+	for (size_t b = 0; b < blocks.size(); b++) {
+		block& bl = blocks[b];
+		const MachineInstr& last = in[bl.last];
+		if (last.op == Opcode::Jmp || is_conditional_jump(last.op)) {
+			auto target = label_blocks.find(label_key(last.dst));
+			if (target == label_blocks.end()) throw std::exception("Jump to an undefined label");
+			bl.successors.push_back(target->second);
+		}
+		if (last.op != Opcode::Jmp && last.op != Opcode::Ret && b + 1 < blocks.size()) bl.successors.push_back((int)b + 1);
+		bl.uses = bl.defs = bl.live_in = bl.live_out = register_set(virtual_count);
+	}
+
+	// liveness of the virtual registers, iterated backwards to a fixed point
+	for (block& bl : blocks) {
+		for (int i = bl.first; i <= bl.last; i++) {
+			register_access a;
+			collect(in[i], a);
+			for (int u = 0; u < a.use_count; u++) {
+				if (!is_virtual(a.uses[u])) continue;
+				unsigned int v = a.uses[u] - REGISTER_COUNT;
+				if (!bl.defs.contains(v)) bl.uses.insert(v);
+			}
+			for (int d = 0; d < a.def_count; d++) {
+				if (is_virtual(a.defs[d])) bl.defs.insert(a.defs[d] - REGISTER_COUNT);
+			}
+		}
+	}
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (size_t b = blocks.size(); b-- > 0;) {
+			block& bl = blocks[b];
+			for (int s : bl.successors) {
+				for (size_t w = 0; w < bl.live_out.words.size(); w++) bl.live_out.words[w] |= blocks[s].live_in.words[w];
+			}
+			for (size_t w = 0; w < bl.live_in.words.size(); w++) {
+				unsigned long long live = bl.uses.words[w] | (bl.live_out.words[w] & ~bl.defs.words[w]);
+				if (live != bl.live_in.words[w]) {
+					bl.live_in.words[w] = live;
+					changed = true;
+				}
+			}
+		}
+	}
+
+	// one interval per virtual register from its first to its last live position, and the
+	// exact ranges of the physical registers, which are never live from one block to another
+	std::vector<interval> intervals(virtual_count + 1);
+	fixed_ranges fixed[REGISTER_COUNT];
+	std::vector<int> hints(virtual_count + 1, -1); // a location each register is copied from or to
+	std::vector<bool> read(virtual_count + 1, false);
+	for (block& bl : blocks) {
+		bl.live_in.for_each([&](unsigned int v) { intervals[v].extend(2 * bl.first); });
+		bl.live_out.for_each([&](unsigned int v) { intervals[v].extend(2 * bl.last + 1); });
+		int live_until[REGISTER_COUNT];
+		std::fill(live_until, live_until + REGISTER_COUNT, -1);
+		for (int i = bl.last; i >= bl.first; i--) {
+			register_access a;
+			collect(in[i], a);
+			for (int d = 0; d < a.def_count; d++) {
+				int l = a.defs[d];
+				if (is_virtual(l)) {
+					intervals[l - REGISTER_COUNT].extend(2 * i + 1);
+					continue;
+				}
+				fixed[l].ranges.push_back({ 2 * i + 1, std::max(live_until[l], 2 * i + 1) });
+				live_until[l] = -1;
+			}
+			for (int u = 0; u < a.use_count; u++) {
+				int l = a.uses[u];
+				if (is_virtual(l)) {
+					intervals[l - REGISTER_COUNT].extend(2 * i);
+					read[l - REGISTER_COUNT] = true;
+				}
+				else if (live_until[l] < 0) live_until[l] = 2 * i;
+			}
+			const MachineInstr& m = in[i];
+			if (m.op == Opcode::Mov && m.s == i64 && m.src.type == OperandType::Register && m.dst.type == OperandType::Register) {
+				if (m.dst.virt) hints[m.dst.virt] = location(m.src);
+				if (m.src.virt && hints[m.src.virt] < 0) hints[m.src.virt] = location(m.dst);
+			}
+		}
+		for (int r = 0; r < REGISTER_COUNT; r++) {
+			if (live_until[r] >= 0) fixed[r].ranges.push_back({ 2 * bl.first, live_until[r] });
+		}
+	}
+	for (fixed_ranges& f : fixed) std::sort(f.ranges.begin(), f.ranges.end(), [](const interval& a, const interval& b) { return a.start < b.start; });
+
+	std::vector<unsigned int> order;
+	for (unsigned int v = 1; v <= virtual_count; v++) {
+		if (intervals[v].end >= 0) order.push_back(v);
+	}
+	std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return intervals[a].start < intervals[b].start; });
+
+	std::vector<int> assigned(virtual_count + 1, -1), slots(virtual_count + 1, -1);
+	std::vector<unsigned int> active;
+	unsigned int owner[REGISTER_COUNT] = {};
+	int spill_count = 0;
+	for (unsigned int v : order) {
+		const interval& current = intervals[v];
+		for (size_t a = 0; a < active.size();) {
+			if (intervals[active[a]].end < current.start) {
+				owner[assigned[active[a]]] = 0;
+				active[a] = active.back();
+				active.pop_back();
+			}
+			else a++;
+		}
+		auto available = [&](int r) { return owner[r] == 0 && !fixed[r].overlaps(current); };
+		int chosen = -1;
+		int hint = hints[v];
+		if (hint >= 0 && is_virtual(hint)) hint = assigned[hint - REGISTER_COUNT];
+		if (hint >= 0 && std::find(std::begin(allocatable), std::end(allocatable), (reg)hint) != std::end(allocatable) && available(hint)) chosen = hint;
+		for (int i = 0; chosen < 0 && i < (int)(sizeof(allocatable) / sizeof(allocatable[0])); i++) {
+			if (available(allocatable[i])) chosen = allocatable[i];
+		}
+		if (chosen < 0) {
+			// spill whichever of this and the values in registers it could use lives longest
+			unsigned int longest = 0;
+			for (unsigned int a : active) {
+				if (!fixed[assigned[a]].overlaps(current) && (!longest || intervals[a].end > intervals[longest].end)) longest = a;
+			}
+			if (longest && intervals[longest].end > current.end) {
+				chosen = assigned[longest];
+				assigned[longest] = -1;
+				slots[longest] = spill_count++;
+				active.erase(std::find(active.begin(), active.end(), longest));
+			}
+			else {
+				slots[v] = spill_count++;
+				continue;
+			}
+		}
+		assigned[v] = chosen;
+		owner[chosen] = v;
+		active.push_back(v);
+	}
+
+	// the frame from rbp down: variables, saved registers, spill slots and the outgoing area,
+	// keeping rsp 16 byte aligned at calls
+	std::vector<reg> saved;
+	for (reg r : allocatable) {
+		if (!callee_saved(r)) continue;
+		for (unsigned int v = 1; v <= virtual_count; v++) {
+			if (assigned[v] == r) {
+				saved.push_back(r);
+				break;
+			}
+		}
+	}
+	locals = (locals + 7) / 8 * 8;
+	int frame = (locals + 8 * (int)saved.size() + 8 * spill_count + outgoing + 15) / 16 * 16;
+	auto save_slot = [&](size_t i) { return memory_operand(rbp, -(locals + 8 * (int)(i + 1))); };
+	auto spill_slot = [&](unsigned int v) { return memory_operand(rbp, -(locals + 8 * (int)saved.size() + 8 * (slots[v] + 1))); };
+
+	code.push_back(machine_instr(Opcode::Push, i64, MachineOperand(), register_operand(rbp)));
+	code.push_back(machine_instr(Opcode::Mov, i64, register_operand(rsp), register_operand(rbp)));
+	if (frame) code.push_back(machine_instr(Opcode::Sub, i64, immediate_operand(frame), register_operand(rsp)));
+	for (size_t i = 0; i < saved.size(); i++) code.push_back(machine_instr(Opcode::Mov, i64, register_operand(saved[i]), save_slot(i)));
+
+	for (MachineInstr m : in) {
+		if (m.op == Opcode::Ret) {
+			for (size_t i = 0; i < saved.size(); i++) code.push_back(machine_instr(Opcode::Mov, i64, save_slot(i), register_operand(saved[i])));
+			code.push_back(machine_instr(Opcode::Mov, i64, register_operand(rbp), register_operand(rsp)));
+			code.push_back(machine_instr(Opcode::Pop, i64, MachineOperand(), register_operand(rbp)));
+			code.push_back(m);
+			continue;
+		}
+		// values that are never read, like the old value of an unused i++, aren't computed
+		if ((m.op == Opcode::Mov || m.op == Opcode::Movsx || m.op == Opcode::Lea) && m.dst.type == OperandType::Register && m.dst.virt && !read[m.dst.virt]) continue;
+		bool reads, writes;
+		destination_role(m, reads, writes);
+		bool store = false;
+		unsigned int dst_virt = m.dst.virt;
+		// a spilled value is used in place in its slot where the instruction takes memory,
+		// and through a scratch register where it doesn't
+		if (m.dst.virt && slots[m.dst.virt] >= 0) {
+			if (m.dst.type == OperandType::Memory) {
+				code.push_back(machine_instr(Opcode::Mov, i64, spill_slot(m.dst.virt), register_operand(SCRATCH_DESTINATION)));
+				m.dst = memory_operand(SCRATCH_DESTINATION, m.dst.value);
+			}
+			else if (m.op != Opcode::Imul && m.op != Opcode::Lea && m.op != Opcode::Movsx && m.src.type != OperandType::Memory
+				&& !(m.src.virt && slots[m.src.virt] >= 0)) {
+				m.dst = spill_slot(m.dst.virt);
+			}
+			else {
+				if (reads) code.push_back(machine_instr(Opcode::Mov, i64, spill_slot(m.dst.virt), register_operand(SCRATCH_DESTINATION)));
+				m.dst = register_operand(SCRATCH_DESTINATION, m.dst.s);
+				store = writes;
+			}
+		}
+		else if (m.dst.virt) {
+			m.dst.r = (reg)assigned[m.dst.virt];
+			m.dst.virt = 0;
+		}
+		if (m.src.virt && slots[m.src.virt] >= 0) {
+			bool takes_memory = m.op == Opcode::Mov || m.op == Opcode::Add || m.op == Opcode::Sub || m.op == Opcode::Cmp || m.op == Opcode::And
+				|| m.op == Opcode::Or || m.op == Opcode::Xor || m.op == Opcode::Imul || m.op == Opcode::Movsx;
+			if (m.src.type == OperandType::Memory) {
+				code.push_back(machine_instr(Opcode::Mov, i64, spill_slot(m.src.virt), register_operand(SCRATCH_SOURCE)));
+				m.src = memory_operand(SCRATCH_SOURCE, m.src.value);
+			}
+			else if (takes_memory && m.dst.type != OperandType::Memory) m.src = spill_slot(m.src.virt);
+			else {
+				code.push_back(machine_instr(Opcode::Mov, i64, spill_slot(m.src.virt), register_operand(SCRATCH_SOURCE)));
+				m.src = register_operand(SCRATCH_SOURCE, m.src.s);
+			}
+		}
+		else if (m.src.virt) {
+			m.src.r = (reg)assigned[m.src.virt];
+			m.src.virt = 0;
+		}
+		// copies between values that ended up in the same register disappear
+		if (m.op == Opcode::Mov && m.s == i64 && m.src.type == OperandType::Register && m.dst.type == OperandType::Register && m.src.r == m.dst.r) continue;
+		code.push_back(m);
+		if (store) code.push_back(machine_instr(Opcode::Mov, i64, register_operand(SCRATCH_DESTINATION), spill_slot(dst_virt)));
+	}
+}
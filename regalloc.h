@@ -0,0 +1,11 @@
+#pragma once
+#include <vector>
+#include "machine.h"
+
+// linear scan register allocation, after Poletto and Sarkar, over the code of one function.
+// code[body] onwards is the function after its label: virtual registers, memory below
+// -locals(%rbp) for its variables and an outgoing area of outgoing bytes at (%rsp) for the
+// arguments of calls. every virtual register gets a physical register, or a stack slot if
+// none is free for all of its lifetime, and the prologue and the epilogue before every ret
+// set up the frame and save the callee-saved registers the function ends up using
+void allocate_registers(std::vector<MachineInstr>& code, size_t body, int locals, int outgoing);
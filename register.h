@@ -1,11 +1,14 @@
 #pragma once
 #include <string>
 
-enum reg {
-	rax, rbx, rcx, rdx, r8, r9
+enum reg : unsigned char {
+	rax, rbx, rcx, rdx, r8, r9, rsp, rbp,
+	rsi, rdi, r10, r11, r12, r13, r14, r15
 };
 
-enum size {
+const int REGISTER_COUNT = r15 + 1;
+
+enum size : unsigned char {
 	i8, i16, i32, i64
 };
 
@@ -27,7 +30,7 @@ inline size _size(int s) {
 	}
 }
 
-inline std::string _suffix(size s) {
+inline const char* _suffix(size s) {
 	switch (s) {
 	case i8: return "b";
 	case i16: return "w";
@@ -36,7 +39,7 @@ inline std::string _suffix(size s) {
 	}
 }
 
-inline std::string _register(reg r, size s) {
+inline const char* _register(reg r, size s) {
 	switch (r) {
 	case rax:
 		switch (s) {
@@ -80,6 +83,76 @@ inline std::string _register(reg r, size s) {
 		case i32: return "r9d";
 		case i64: return "r9";
 		}
+	case rsp:
+		switch (s) {
+		case i8: return "spl";
+		case i16: return "sp";
+		case i32: return "esp";
+		case i64: return "rsp";
+		}
+	case rbp:
+		switch (s) {
+		case i8: return "bpl";
+		case i16: return "bp";
+		case i32: return "ebp";
+		case i64: return "rbp";
+		}
+	case rsi:
+		switch (s) {
+		case i8: return "sil";
+		case i16: return "si";
+		case i32: return "esi";
+		case i64: return "rsi";
+		}
+	case rdi:
+		switch (s) {
+		case i8: return "dil";
+		case i16: return "di";
+		case i32: return "edi";
+		case i64: return "rdi";
+		}
+	case r10:
+		switch (s) {
+		case i8: return "r10b";
+		case i16: return "r10w";
+		case i32: return "r10d";
+		case i64: return "r10";
+		}
+	case r11:
+		switch (s) {
+		case i8: return "r11b";
+		case i16: return "r11w";
+		case i32: return "r11d";
+		case i64: return "r11";
+		}
+	case r12:
+		switch (s) {
+		case i8: return "r12b";
+		case i16: return "r12w";
+		case i32: return "r12d";
+		case i64: return "r12";
+		}
+	case r13:
+		switch (s) {
+		case i8: return "r13b";
+		case i16: return "r13w";
+		case i32: return "r13d";
+		case i64: return "r13";
+		}
+	case r14:
+		switch (s) {
+		case i8: return "r14b";
+		case i16: return "r14w";
+		case i32: return "r14d";
+		case i64: return "r14";
+		}
+	case r15:
+		switch (s) {
+		case i8: return "r15b";
+		case i16: return "r15w";
+		case i32: return "r15d";
+		case i64: return "r15";
+		}
 	}
 	return "";
 }
\ No newline at end of file
@@ -0,0 +1,200 @@
+#include "scan.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+inline bool is_space_char(char c) {
+	return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+inline bool is_name_char(char c) {
+	return (unsigned char)((c | 0x20) - 'a') <= 'z' - 'a' || (unsigned char)(c - '0') <= 9 || c == '_' || c == '$';
+}
+
+inline bool is_string_special(char c) {
+	return c == '"' || c == '\\' || c == '\n' || c == '\r';
+}
+
+const char* skip_whitespace_scalar(const char* p, const char* end) {
+	while (p != end && is_space_char(*p)) p++;
+	return p;
+}
+
+const char* skip_name_chars_scalar(const char* p, const char* end) {
+	while (p != end && is_name_char(*p)) p++;
+	return p;
+}
+
+const char* find_string_special_scalar(const char* p, const char* end) {
+	while (p != end && !is_string_special(*p)) p++;
+	return p;
+}
+
+#ifdef SCAN_X86
+
+inline unsigned first_set(unsigned mask) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+// the classifiers return a vector with 0xff in every byte that belongs to the class.
+// a range lo..hi is tested with one wrapping subtract and one saturating subtract
+
+inline __m128i in_range_sse2(__m128i v, char lo, char hi) {
+	__m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+	return _mm_cmpeq_epi8(_mm_subs_epu8(shifted, _mm_set1_epi8(hi - lo)), _mm_setzero_si128());
+}
+
+inline __m128i space_sse2(__m128i v) {
+	return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), in_range_sse2(v, '\t', '\r'));
+}
+
+inline __m128i name_sse2(__m128i v) {
+	__m128i letter = in_range_sse2(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+	__m128i digit = in_range_sse2(v, '0', '9');
+	__m128i other = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('_')), _mm_cmpeq_epi8(v, _mm_set1_epi8('$')));
+	return _mm_or_si128(_mm_or_si128(letter, digit), other);
+}
+
+inline __m128i string_special_sse2(__m128i v) {
+	__m128i quote = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+	__m128i newline = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+	return _mm_or_si128(quote, newline);
+}
+
+// stop_inside: the run ends at the first byte inside the class instead of outside it
+template <__m128i (*classify)(__m128i), bool stop_inside>
+const char* scan_sse2(const char* p, const char* end) {
+	while (end - p >= 16) {
+		unsigned mask = _mm_movemask_epi8(classify(_mm_loadu_si128((const __m128i*)p)));
+		if (!stop_inside) mask ^= 0xffff;
+		if (mask) return p + first_set(mask);
+		p += 16;
+	}
+	return p;
+}
+
+TARGET_AVX2 inline __m256i in_range_avx2(__m256i v, char lo, char hi) {
+	__m256i shifted = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+	return _mm256_cmpeq_epi8(_mm256_subs_epu8(shifted, _mm256_set1_epi8(hi - lo)), _mm256_setzero_si256());
+}
+
+TARGET_AVX2 inline __m256i space_avx2(__m256i v) {
+	return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), in_range_avx2(v, '\t', '\r'));
+}
+
+TARGET_AVX2 inline __m256i name_avx2(__m256i v) {
+	__m256i letter = in_range_avx2(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+	__m256i digit = in_range_avx2(v, '0', '9');
+	__m256i other = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('$')));
+	return _mm256_or_si256(_mm256_or_si256(letter, digit), other);
+}
+
+TARGET_AVX2 inline __m256i string_special_avx2(__m256i v) {
+	__m256i quote = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+	__m256i newline = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+	return _mm256_or_si256(quote, newline);
+}
+
+// the upper halves of the ymm registers are cleared before leaving, otherwise the SSE code
+// that runs next pays for a state transition on every call
+template <__m256i (*classify)(__m256i), bool stop_inside>
+TARGET_AVX2 const char* scan_avx2(const char* p, const char* end) {
+	while (end - p >= 32) {
+		unsigned mask = (unsigned)_mm256_movemask_epi8(classify(_mm256_loadu_si256((const __m256i*)p)));
+		if (!stop_inside) mask = ~mask;
+		if (mask) {
+			_mm256_zeroupper();
+			return p + first_set(mask);
+		}
+		p += 32;
+	}
+	_mm256_zeroupper();
+	return p;
+}
+
+// most runs are short, so the first character is checked before any vector work and the
+// tail that doesn't fill a whole vector is finished by the scalar loop
+
+const char* skip_whitespace_sse2(const char* p, const char* end) {
+	if (p == end || !is_space_char(*p)) return p;
+	return skip_whitespace_scalar(scan_sse2<space_sse2, false>(p, end), end);
+}
+
+const char* skip_name_chars_sse2(const char* p, const char* end) {
+	if (p == end || !is_name_char(*p)) return p;
+	return skip_name_chars_scalar(scan_sse2<name_sse2, false>(p, end), end);
+}
+
+const char* find_string_special_sse2(const char* p, const char* end) {
+	return find_string_special_scalar(scan_sse2<string_special_sse2, true>(p, end), end);
+}
+
+TARGET_AVX2 const char* skip_whitespace_avx2(const char* p, const char* end) {
+	if (p == end || !is_space_char(*p)) return p;
+	return skip_whitespace_sse2(scan_avx2<space_avx2, false>(p, end), end);
+}
+
+TARGET_AVX2 const char* skip_name_chars_avx2(const char* p, const char* end) {
+	if (p == end || !is_name_char(*p)) return p;
+	return skip_name_chars_sse2(scan_avx2<name_avx2, false>(p, end), end);
+}
+
+TARGET_AVX2 const char* find_string_special_avx2(const char* p, const char* end) {
+	return find_string_special_sse2(scan_avx2<string_special_avx2, true>(p, end), end);
+}
+
+void cpuid(int leaf, int regs[4]) {
+#ifdef _MSC_VER
+	__cpuidex(regs, leaf, 0);
+#else
+	__asm__ __volatile__("cpuid" : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3]) : "a"(leaf), "c"(0));
+#endif
+}
+
+unsigned long long xgetbv0() {
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned eax, edx;
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+#endif
+
+scanner select_scanner() {
+#ifdef SCAN_X86
+	int regs[4];
+	cpuid(0, regs);
+	int max_leaf = regs[0];
+	cpuid(1, regs);
+	bool sse2 = regs[3] & (1 << 26);
+	// avx2 also needs the OS to save the ymm registers, which it reports through xgetbv
+	bool os_ymm = (regs[2] & (1 << 27)) && (xgetbv0() & 6) == 6;
+	bool avx2 = false;
+	if (max_leaf >= 7 && os_ymm) {
+		cpuid(7, regs);
+		avx2 = regs[1] & (1 << 5);
+	}
+	if (avx2) return { skip_whitespace_avx2, skip_name_chars_avx2, find_string_special_avx2, "avx2" };
+	if (sse2) return { skip_whitespace_sse2, skip_name_chars_sse2, find_string_special_sse2, "sse2" };
+#endif
+	return { skip_whitespace_scalar, skip_name_chars_scalar, find_string_special_scalar, "scalar" };
+}
+
+const scanner scan = select_scanner();
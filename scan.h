@@ -0,0 +1,16 @@
+#pragma once
+
+// character class scanners for the lexer's hot loops. each returns the first character in
+// [p, end) that is not part of the run, or end. SSE2 or AVX2 versions are picked at startup
+// from CPUID, with a scalar fallback when neither is available
+struct scanner {
+	// whitespace as classified by isspace in the C locale
+	const char* (*skip_whitespace)(const char* p, const char* end);
+	// [a-zA-Z0-9_$]
+	const char* (*skip_name_chars)(const char* p, const char* end);
+	// first '"', '\\', '\n' or '\r', the characters that end a run inside a string literal
+	const char* (*find_string_special)(const char* p, const char* end);
+	const char* name;
+};
+
+extern const scanner scan;
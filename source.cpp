@@ -0,0 +1,66 @@
+#include "source.h"
+#include <exception>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+source_buffer::source_buffer(const char* path) {
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		file = nullptr;
+		throw std::exception("Could not open source file");
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size)) {
+		CloseHandle(file);
+		throw std::exception("Could not read source file");
+	}
+	length = (size_t)file_size.QuadPart;
+	if (length == 0) return; // empty files can't be mapped
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping) data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!data) {
+		if (mapping) CloseHandle(mapping);
+		CloseHandle(file);
+		throw std::exception("Could not map source file");
+	}
+}
+
+source_buffer::~source_buffer() {
+	if (data) UnmapViewOfFile(data);
+	if (mapping) CloseHandle(mapping);
+	if (file) CloseHandle(file);
+}
+
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+source_buffer::source_buffer(const char* path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) throw std::exception("Could not open source file");
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		throw std::exception("Could not read source file");
+	}
+	length = (size_t)st.st_size;
+	if (length == 0) { // empty files can't be mapped
+		close(fd);
+		return;
+	}
+	void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED) throw std::exception("Could not map source file");
+	madvise(mapped, length, MADV_SEQUENTIAL);
+	data = (const char*)mapped;
+}
+
+source_buffer::~source_buffer() {
+	if (data) munmap((void*)data, length);
+}
+
+#endif
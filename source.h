@@ -0,0 +1,24 @@
+#pragma once
+#include <string_view>
+
+// read-only view of an input file mapped straight into memory, tokens point into it
+// so it has to outlive every token produced from it
+struct source_buffer {
+	source_buffer(const char* path);
+	~source_buffer();
+
+	source_buffer(const source_buffer&) = delete;
+	source_buffer& operator=(const source_buffer&) = delete;
+
+	std::string_view view() const {
+		return std::string_view(data, length);
+	}
+
+private:
+	const char* data = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#endif
+};
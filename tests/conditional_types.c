@@ -0,0 +1,10 @@
+int pick(int x, char c, long big) {
+	int a = (x ? c : 300) == 300;
+	int b = (x ? x : big) == big;
+	return a * 10 + b + 20;
+}
+
+int main() {
+	long k = 100000;
+	return pick(0, 1, k * k + 7l);
+}
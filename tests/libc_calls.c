@@ -0,0 +1,25 @@
+long* malloc(long n);
+void free(long* p);
+long* memset(long* p, int c, long n);
+int abs(int x);
+int printf(char* format, long a, long b, long c, long d, long e, long f, long g);
+
+long many(long a, long b, long c, long d, long e, long f, long g, long h) {
+	return a + b * 2 + c * 3 + d * 4 + e * 5 + f * 6 + g * 7 + h * 8;
+}
+
+int main() {
+	long* p = malloc(800);
+	memset(p, 0, 800);
+	for (int i = 0; i < 100; i++) {
+		p[i] = p[i] + i;
+	}
+	long s = 0l;
+	for (int i = 0; i < 100; i++) {
+		s = s + p[i];
+	}
+	free(p);
+	long m = many(1l, 2l, 3l, 4l, 5l, 6l, 7l, 8l);
+	printf("%ld %ld %ld %ld %ld %ld %ld\n", 1l, 2l, 3l, 4l, 5l, 6l, 7l);
+	return (s + m + abs(-7)) & 255;
+}
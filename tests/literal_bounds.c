@@ -0,0 +1,31 @@
+long* malloc(long n);
+
+void add(int* a, int* b, int* c) {
+	for (int i = 0; i < 100; i++) {
+		a[i] = b[i] + c[i];
+	}
+}
+
+long total(long* a) {
+	long s = 0l;
+	for (long i = 3l; i < 75l; i++) {
+		s = s + a[i];
+	}
+	return s;
+}
+
+int main() {
+	int* a = malloc(400);
+	int* b = malloc(400);
+	long* l = malloc(800);
+	for (int i = 0; i < 100; i++) {
+		b[i] = i * 3;
+		l[i] = i * 5;
+	}
+	add(a, b, b);
+	int h = 0;
+	for (int i = 0; i < 100; i++) {
+		h = h * 7 + a[i];
+	}
+	return (h + total(l)) & 255;
+}
@@ -0,0 +1,75 @@
+#!/bin/bash
+# runs each program here through the compiler given as $1 and checks the exit code it
+# returns in the bytecode VM, in the JIT, and linked with gcc against the C library from an
+# object file and from assembly text. what it prints has to match the object's output in
+# every other form. also checks that loops meant to vectorize do. needs Linux on x86-64
+#   tests/run.sh path/to/compiler
+
+compiler=$(realpath "${1:?usage: tests/run.sh compiler}")
+cd "$(dirname "$0")"
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+failed=0
+
+# program and the exit code it has to return
+expected=(
+	libc_calls.c 41
+	literal_bounds.c 208
+	conditional_types.c 20
+)
+
+# program and the number of its loops that have to become vector operations
+vectorized=(
+	literal_bounds.c 2
+)
+
+check() {
+	local name=$1 how=$2 want=$3 got=$4
+	if [ "$got" != "$want" ]; then
+		echo "FAIL $name ($how): returned $got, expected $want"
+		failed=1
+	fi
+}
+
+check_output() {
+	local name=$1 how=$2
+	[ -f "$work/native.out" ] || return
+	if ! cmp -s "$work/native.out" "$work/out"; then
+		echo "FAIL $name ($how): printed something other than the object file"
+		failed=1
+	fi
+}
+
+for ((i = 0; i < ${#expected[@]}; i += 2)); do
+	program=${expected[i]}
+	want=${expected[i + 1]}
+	if "$compiler" "$program" "$work/p.o" && gcc -no-pie -o "$work/p" "$work/p.o"; then
+		"$work/p" > "$work/native.out"
+		check "$program" object "$want" $?
+	else
+		check "$program" object "$want" "no executable"
+		rm -f "$work/native.out"
+	fi
+	"$compiler" -vm "$program" > "$work/out" 2>/dev/null
+	check "$program" vm "$want" $?
+	check_output "$program" vm
+	"$compiler" -jit "$program" > "$work/out" 2>/dev/null
+	check "$program" jit "$want" $?
+	check_output "$program" jit
+	if "$compiler" -S "$program" "$work/p.s" && gcc -no-pie -Wa,--noexecstack -o "$work/p" "$work/p.s"; then
+		"$work/p" > "$work/out"
+		check "$program" text "$want" $?
+		check_output "$program" text
+	else
+		check "$program" text "$want" "no executable"
+	fi
+done
+
+for ((i = 0; i < ${#vectorized[@]}; i += 2)); do
+	program=${vectorized[i]}
+	"$compiler" -ir "$program" "$work/p.ir"
+	check "$program" "vector operations in -ir" "${vectorized[i + 1]}" "$(grep -c -E 'vecmap|vecsum' "$work/p.ir")"
+done
+
+[ $failed = 0 ] && echo "all tests passed"
+exit $failed
@@ -1,112 +1,341 @@
 #include "tokenize.h"
-#include <iostream>
-#include <regex>
+#include "scan.h"
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <thread>
 
-std::string& ltrim(std::string& str)
-{
-    auto it2 = std::find_if(str.begin(), str.end(), [](char ch) { return !std::isspace(ch); });
-    str.erase(str.begin(), it2);
-    return str;
+// single pass lexer: the cursor walks the input once and every token is recognized by
+// switching on its first character and then taking the longest operator that matches
+
+inline bool is_name_start(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '$';
+}
+
+inline bool is_digit(char c) {
+    return c >= '0' && c <= '9';
 }
 
-struct token_data {
-    token_type type;
-    std::string regex;
+// keywords are found with a perfect hash over the first character, the last character and
+// the length of an identifier. the seeds and the slot table are searched for at compile
+// time from keyword_spelling(), so a new keyword only needs its spelling added there
+const size_t KEYWORD_SLOTS = 32;
+
+struct keyword_table {
+    unsigned first_seed = 0;
+    unsigned last_seed = 0;
+    token_type type[KEYWORD_SLOTS] = {};
+    const char* text[KEYWORD_SLOTS] = {};
+    size_t length[KEYWORD_SLOTS] = {}; // 0 marks an empty slot
 };
 
-token_data token_regex[] = {
-    {LONG_KEYWORD, R"(long)"},
-    {CHAR_KEYWORD, R"(char)"},
-    {SHORT_KEYWORD, R"(short)"},
-    {INT_KEYWORD, R"(int)"},
-    {RETURN_KEYWORD, R"(return)"},
-    {STRUCT_KEYWORD, R"(struct)"},
-    {VOID_KEYWORD, R"(void)"},
-
-    {FOR_KEYWORD, R"(for)"},
-    {WHILE_KEYWORD, R"(while)"},
-    {DO_KEYWORD, R"(do)"},
-    {BREAK_KEYWORD, R"(break)"},
-    {CONTINUE_KEYWORD, R"(continue)"},
-
-    {IF_KEYWORD, R"(if)"},
-    {ELSE_KEYWORD, R"(else)"},
-    {COLON, R"(:)"},
-    {SEMICOLON, R"(;)"},
-    {ARROW, R"(\->)"},
-    {DOT, R"(\.)"},
-    {QUESTION_MARK, R"(\?)"},
-
-    {INCREMENT, R"(\+\+)"},
-    {DECREMENT, R"(\-\-)"},
-
-    {ADD_ASSIGN, R"(\+=)"},
-    {SUBTRACT_ASSIGN, R"(\-=)"},
-    {MULTIPLY_ASSIGN, R"(\*=)"},
-    {DIVIDE_ASSIGN, R"(\/=)"},
-    {MOD_ASSIGN, R"(%=)"},
-    {AND_ASSIGN, R"(&=)"},
-    {OR_ASSIGN, R"(\|=)"},
-    {XOR_ASSIGN, R"(\^=)"},
-    {LEFT_SHIFT_ASSIGN, R"(<<=)"},
-    {RIGHT_SHIFT_ASSIGN, R"(>>=)"},
-
-    {PLUS, R"(\+)"},
-    {MINUS, R"(\-)"},
-    {ASTERISK, R"(\*)"},
-    {SLASH, R"(\/)"},
-    {MODULUS, R"(%)"},
-
-    {LEFT_SHIFT, R"(<<)"},
-    {RIGHT_SHIFT, R"(>>)"},
-
-    {EQUAL_TO, R"(==)"},
-    {NOT_EQUAL_TO, R"(!=)"},
-    {GREATER_OR_EQUAL_TO, R"(>=)"},
-    {GREATER_THAN, R"(>)"},
-    {LESS_OR_EQUAL_TO, R"(<=)"},
-    {LESS_THAN, R"(<)"},
-
-    {EXCLAMATION, R"(!)"},
-    {EQUAL_SIGN, R"(=)"},
-
-    {LOGICAL_AND, R"(&&)"},
-    {LOGICAL_OR, R"(\|\|)"},
-
-    {OPEN_PARENTHESES, R"(\()"},
-    {CLOSE_PARENTHESES, R"(\))"},
-
-    {BITWISE_COMPLEMENT, R"(~)"},
-    {BITWISE_AND, R"(&)"},
-    {BITWISE_OR, R"(\|)"},
-    {BITWISE_XOR, R"(\^)"},
-
-    {COMMA, R"(,)"},
-
-    {OPEN_BRACKET, R"(\[)"},
-    {CLOSE_BRACKET, R"(\])"},
-    {OPEN_BRACES, R"(\{)"},
-    {CLOSE_BRACES, R"(\})"},
-    {STRING_VALUE, R"(\"(.|\\n)*\")"},
-    {CHAR_VALUE, R"('(.|\\n)')"},
-    {SHORT_VALUE, R"([0-9]+[sS])"},
-    {LONG_VALUE, R"([0-9]+[lL])"},
-    {INT_VALUE, R"([0-9]+)"},
-    {NAME, R"([a-zA-Z_$][a-zA-Z_$0-9]*)"}
+constexpr size_t keyword_hash(unsigned first_seed, unsigned last_seed, const char* s, size_t length) {
+    return ((unsigned char)s[0] * first_seed + (unsigned char)s[length - 1] * last_seed + length) % KEYWORD_SLOTS;
+}
+
+constexpr bool place_keywords(keyword_table& table) {
+    for (int t = 0; t < END_OF_INPUT; t++) {
+        const char* text = keyword_spelling((token_type)t);
+        if (!text) continue;
+        size_t length = 0;
+        while (text[length]) length++;
+        size_t slot = keyword_hash(table.first_seed, table.last_seed, text, length);
+        if (table.length[slot]) return false;
+        table.type[slot] = (token_type)t;
+        table.text[slot] = text;
+        table.length[slot] = length;
+    }
+    return true;
+}
+
+constexpr keyword_table build_keyword_table() {
+    for (unsigned first_seed = 1; first_seed < 256; first_seed++) {
+        for (unsigned last_seed = 1; last_seed < 256; last_seed++) {
+            keyword_table table;
+            table.first_seed = first_seed;
+            table.last_seed = last_seed;
+            if (place_keywords(table)) return table;
+        }
+    }
+    throw "no perfect hash for the keyword set, increase KEYWORD_SLOTS";
+}
+
+constexpr keyword_table keyword_slots = build_keyword_table();
+
+inline token_type classify_name(const char* s, size_t length) {
+    size_t slot = keyword_hash(keyword_slots.first_seed, keyword_slots.last_seed, s, length);
+    if (keyword_slots.length[slot] == length && std::char_traits<char>::compare(s, keyword_slots.text[slot], length) == 0)
+        return keyword_slots.type[slot];
+    return NAME;
+}
+
+size_t scan_name(const char* p, const char* end, token_type& type) {
+    const char* q = scan.skip_name_chars(p + 1, end);
+    type = classify_name(p, q - p);
+    return q - p;
+}
+
+size_t scan_number(const char* p, const char* end, token_type& type) {
+    const char* q = p;
+    while (q != end && is_digit(*q)) q++;
+    type = INT_VALUE;
+    if (q != end) {
+        if (*q == 's' || *q == 'S') {
+            type = SHORT_VALUE;
+            q++;
+        }
+        else if (*q == 'l' || *q == 'L') {
+            type = LONG_VALUE;
+            q++;
+        }
+    }
+    return q - p;
+}
+
+// returns 0 if the literal is not terminated before the end of the line
+size_t scan_string(const char* p, const char* end) {
+    const char* q = scan.find_string_special(p + 1, end);
+    while (q != end && *q == '\\') {
+        q++;
+        if (q != end && *q != '\n' && *q != '\r') q++;
+        q = scan.find_string_special(q, end);
+    }
+    if (q == end || *q != '"') return 0;
+    return q + 1 - p;
+}
+
+size_t scan_char(const char* p, const char* end) {
+    size_t available = end - p;
+    if (available >= 3 && p[1] != '\n' && p[1] != '\r' && p[2] == '\'') return 3;
+    if (available >= 4 && p[1] == '\\' && p[3] == '\'') return 4;
+    return 0;
+}
+
+inline bool next_is(const char* p, const char* end, char c) {
+    return p + 1 != end && p[1] == c;
+}
+
+// an operator character on its own or followed by '='
+inline size_t scan_assign(const char* p, const char* end, token_type& type, token_type single, token_type assign) {
+    if (next_is(p, end, '=')) {
+        type = assign;
+        return 2;
+    }
+    type = single;
+    return 1;
+}
+
+// +, ++, += and the matching -, &, | families
+inline size_t scan_double(const char* p, const char* end, token_type& type, token_type single, token_type twice, token_type assign) {
+    if (next_is(p, end, *p)) {
+        type = twice;
+        return 2;
+    }
+    return scan_assign(p, end, type, single, assign);
+}
+
+// <, <<, <=, <<= and the matching > family
+inline size_t scan_shift(const char* p, const char* end, token_type& type,
+    token_type single, token_type or_equal, token_type shift, token_type shift_assign) {
+    if (next_is(p, end, *p)) {
+        if (p + 2 != end && p[2] == '=') {
+            type = shift_assign;
+            return 3;
+        }
+        type = shift;
+        return 2;
+    }
+    return scan_assign(p, end, type, single, or_equal);
+}
+
+size_t scan_token(const char* p, const char* end, token_type& type) {
+    switch (*p) {
+    case ':': type = COLON; return 1;
+    case ';': type = SEMICOLON; return 1;
+    case '.': type = DOT; return 1;
+    case '?': type = QUESTION_MARK; return 1;
+    case '(': type = OPEN_PARENTHESES; return 1;
+    case ')': type = CLOSE_PARENTHESES; return 1;
+    case '~': type = BITWISE_COMPLEMENT; return 1;
+    case ',': type = COMMA; return 1;
+    case '[': type = OPEN_BRACKET; return 1;
+    case ']': type = CLOSE_BRACKET; return 1;
+    case '{': type = OPEN_BRACES; return 1;
+    case '}': type = CLOSE_BRACES; return 1;
+
+    case '+': return scan_double(p, end, type, PLUS, INCREMENT, ADD_ASSIGN);
+    case '-':
+        if (next_is(p, end, '>')) {
+            type = ARROW;
+            return 2;
+        }
+        return scan_double(p, end, type, MINUS, DECREMENT, SUBTRACT_ASSIGN);
+    case '&': return scan_double(p, end, type, BITWISE_AND, LOGICAL_AND, AND_ASSIGN);
+    case '|': return scan_double(p, end, type, BITWISE_OR, LOGICAL_OR, OR_ASSIGN);
+    case '*': return scan_assign(p, end, type, ASTERISK, MULTIPLY_ASSIGN);
+    case '/': return scan_assign(p, end, type, SLASH, DIVIDE_ASSIGN);
+    case '%': return scan_assign(p, end, type, MODULUS, MOD_ASSIGN);
+    case '^': return scan_assign(p, end, type, BITWISE_XOR, XOR_ASSIGN);
+    case '!': return scan_assign(p, end, type, EXCLAMATION, NOT_EQUAL_TO);
+    case '=': return scan_assign(p, end, type, EQUAL_SIGN, EQUAL_TO);
+    case '<': return scan_shift(p, end, type, LESS_THAN, LESS_OR_EQUAL_TO, LEFT_SHIFT, LEFT_SHIFT_ASSIGN);
+    case '>': return scan_shift(p, end, type, GREATER_THAN, GREATER_OR_EQUAL_TO, RIGHT_SHIFT, RIGHT_SHIFT_ASSIGN);
+
+    case '"': type = STRING_VALUE; return scan_string(p, end);
+    case '\'': type = CHAR_VALUE; return scan_char(p, end);
+    }
+    if (is_digit(*p)) return scan_number(p, end, type);
+    if (is_name_start(*p)) return scan_name(p, end, type);
+    return 0;
+}
+
+// skips whitespace and lexes the token at the cursor, false once the input is used up.
+// NAME tokens are left for the caller to intern
+bool lex_token(const char*& p, const char* end, token& t)
+{
+    p = scan.skip_whitespace(p, end);
+    if (p == end) return false;
+    size_t length = scan_token(p, end, t.type);
+    if (length == 0) throw std::exception("Unrecognized token");
+    t.value = std::string_view(p, length);
+    t.name = NO_SYMBOL;
+    p += length;
+    return true;
+}
+
+const size_t MIN_CHUNK_SIZE = 1 << 20;
+
+// a chunk can start right after any newline that isn't inside a token. string literals
+// end at the end of their line, so the only token that can hold a newline is a character
+// literal made of a backslash and a raw newline, and newlines after a backslash are skipped
+const char* chunk_boundary(const char* p, const char* end)
+{
+    while (p != end) {
+        p = (const char*)memchr(p, '\n', end - p);
+        if (!p) return end;
+        p++;
+        if (p[-2] != '\\') return p;
+    }
+    return end;
+}
+
+struct chunk {
+    const char* begin;
+    const char* end;
+    std::vector<token> tokens;
+    // ids local to the chunk, mapped to global ones in chunk order so every name gets
+    // the same id it would get from lexing the whole file on one thread
+    interner names;
+    std::vector<symbol> global_names;
+    std::exception_ptr error;
 };
 
-void tokenize(std::string s, std::queue<token>& tokens)
+void lex_chunk(chunk& c)
 {
-    while (!s.empty()) {
-        s = ltrim(s);
-        for (token_data d : token_regex) {
-            std::smatch m;
-            if (std::regex_search(s, m, std::regex(d.regex), std::regex_constants::match_flag_type::match_continuous)) {
-                    std::string ss = m.str();
-                    tokens.push({ d.type, ss });
-                    s = s.substr(m[0].second - s.begin());
-                    break;
-            }
+    try {
+        const char* p = c.begin;
+        token t;
+        while (lex_token(p, c.end, t)) {
+            if (t.type == NAME) t.name = c.names.intern(t.value);
+            c.tokens.push_back(t);
+        }
+    }
+    catch (...) {
+        c.error = std::current_exception();
+    }
+}
+
+template <class F>
+void for_each_chunk(std::vector<chunk>& chunks, F f)
+{
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < chunks.size(); i++) {
+        threads.emplace_back(f, std::ref(chunks[i]));
+    }
+    f(chunks[0]);
+    for (std::thread& t : threads) t.join();
+}
+
+void tokenize(std::string_view s, std::vector<token>& tokens)
+{
+    const char* begin = s.data();
+    const char* end = begin + s.size();
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t chunk_count = std::min(threads, s.size() / MIN_CHUNK_SIZE);
+
+    if (chunk_count <= 1) {
+        token t;
+        while (lex_token(begin, end, t)) {
+            if (t.type == NAME) t.name = intern(t.value);
+            tokens.push_back(t);
         }
+        return;
+    }
+
+    std::vector<chunk> chunks;
+    const char* p = begin;
+    for (size_t i = 1; i <= chunk_count && p != end; i++) {
+        const char* next = i == chunk_count ? end : chunk_boundary(std::max(p, begin + s.size() * i / chunk_count), end);
+        chunks.push_back({ p, next, std::vector<token>(), interner(), std::vector<symbol>(), nullptr });
+        p = next;
+    }
+
+    for_each_chunk(chunks, lex_chunk);
+
+    size_t total = tokens.size();
+    for (chunk& c : chunks) {
+        if (c.error) std::rethrow_exception(c.error);
+        c.global_names.resize(c.names.size());
+        for (size_t i = 0; i < c.names.size(); i++) {
+            c.global_names[i] = intern(c.names.name((symbol)i));
+        }
+        total += c.tokens.size();
+    }
+
+    size_t offset = tokens.size();
+    tokens.resize(total);
+    std::vector<token*> destinations;
+    for (chunk& c : chunks) {
+        destinations.push_back(tokens.data() + offset);
+        offset += c.tokens.size();
+    }
+    for_each_chunk(chunks, [&](chunk& c) {
+        token* out = destinations[&c - chunks.data()];
+        for (const token& t : c.tokens) {
+            *out = t;
+            if (t.type == NAME) out->name = c.global_names[t.name];
+            out++;
+        }
+    });
+}
+
+token_stream::token_stream(std::string_view s)
+    : cursor(s.data()), end(s.data() + s.size()) {
+}
+
+token_stream::token_stream(const std::vector<token>& tokens)
+    : cursor(nullptr), end(nullptr), next_lexed(tokens.data()), end_lexed(tokens.data() + tokens.size()) {
+}
+
+bool token_stream::fill()
+{
+    token& t = ring[(head + count) % LOOKAHEAD];
+    if (next_lexed) {
+        if (next_lexed == end_lexed) return false;
+        t = *next_lexed++;
+    }
+    else {
+        if (!lex_token(cursor, end, t)) return false;
+        if (t.type == NAME) t.name = intern(t.value);
+    }
+    count++;
+    return true;
+}
+
+const token& token_stream::peek(size_t n)
+{
+    while (count <= n) {
+        if (!fill()) return end_token;
     }
+    return ring[(head + n) % LOOKAHEAD];
 }
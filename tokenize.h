@@ -1,6 +1,8 @@
 #pragma once
-#include <queue>
 #include <string>
+#include <string_view>
+#include <vector>
+#include "intern.h"
 
 enum token_type {
 	LONG_KEYWORD, SHORT_KEYWORD, CHAR_KEYWORD, VOID_KEYWORD,
@@ -20,12 +22,81 @@ enum token_type {
 	CHAR_VALUE, SHORT_VALUE, LONG_VALUE, STRING_VALUE,
 	OPEN_BRACKET, CLOSE_BRACKET,
 
-	STRUCT_KEYWORD, DOT, ARROW
+	STRUCT_KEYWORD, DOT, ARROW,
+
+	END_OF_INPUT
 };
 
+// spelling of the keyword tokens, nullptr for every other token type
+constexpr const char* keyword_spelling(token_type type) {
+	switch (type) {
+	case LONG_KEYWORD: return "long";
+	case CHAR_KEYWORD: return "char";
+	case SHORT_KEYWORD: return "short";
+	case INT_KEYWORD: return "int";
+	case RETURN_KEYWORD: return "return";
+	case STRUCT_KEYWORD: return "struct";
+	case VOID_KEYWORD: return "void";
+	case FOR_KEYWORD: return "for";
+	case WHILE_KEYWORD: return "while";
+	case DO_KEYWORD: return "do";
+	case BREAK_KEYWORD: return "break";
+	case CONTINUE_KEYWORD: return "continue";
+	case IF_KEYWORD: return "if";
+	case ELSE_KEYWORD: return "else";
+	default: return nullptr;
+	}
+}
+
 struct token {
 	token_type type;
-	std::string value;
+	std::string_view value; // points into the source buffer
+	symbol name = NO_SYMBOL; // set for NAME tokens
 };
 
-void tokenize(std::string s, std::queue<token>& token_queue);
\ No newline at end of file
+// inputs at least this large are worth lexing up front with tokenize()
+const size_t PARALLEL_TOKENIZE_SIZE = 4 << 20;
+
+// lexes the whole input, splitting large inputs into chunks that are lexed on separate
+// threads. the result is the same as lexing on one thread
+void tokenize(std::string_view s, std::vector<token>& tokens);
+
+// lexes on demand as the parser consumes tokens, so only the lookahead window is ever held
+// in memory, or replays tokens already lexed by tokenize(). past the end of the input
+// front() is an END_OF_INPUT token
+class token_stream {
+public:
+	token_stream(std::string_view s);
+	token_stream(const std::vector<token>& tokens);
+
+	const token& front() {
+		return peek(0);
+	}
+
+	void pop() {
+		if (count == 0 && !fill()) return;
+		head = (head + 1) % LOOKAHEAD;
+		count--;
+	}
+
+	bool empty() {
+		return count == 0 && !fill();
+	}
+
+	// n must be less than LOOKAHEAD
+	const token& peek(size_t n);
+
+private:
+	static const size_t LOOKAHEAD = 4;
+
+	token ring[LOOKAHEAD];
+	size_t head = 0;
+	size_t count = 0;
+	const char* cursor;
+	const char* end;
+	const token* next_lexed = nullptr;
+	const token* end_lexed = nullptr;
+	token end_token = { END_OF_INPUT, std::string_view(), NO_SYMBOL };
+
+	bool fill();
+};
\ No newline at end of file
@@ -0,0 +1,192 @@
+#include "vm.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+
+int bytecode_program::find_function(symbol name) const {
+	for (size_t i = 0; i < functions.size(); i++) {
+		if (functions[i].name == name) return (int)i;
+	}
+	return -1;
+}
+
+// host functions take their arguments as an array of registers, up to MAX_HOST_ARGS of them
+const int MAX_HOST_ARGS = 8;
+typedef long long (*host_function)(long long* args, int count);
+
+struct host_entry {
+	const char* name;
+	host_function function;
+};
+
+const host_entry host_functions[] = {
+	{ "malloc", [](long long* a, int) { return (long long)malloc((size_t)a[0]); } },
+	{ "calloc", [](long long* a, int) { return (long long)calloc((size_t)a[0], (size_t)a[1]); } },
+	{ "realloc", [](long long* a, int) { return (long long)realloc((void*)a[0], (size_t)a[1]); } },
+	{ "free", [](long long* a, int) { free((void*)a[0]); return 0ll; } },
+	{ "memset", [](long long* a, int) { return (long long)memset((void*)a[0], (int)a[1], (size_t)a[2]); } },
+	{ "memcpy", [](long long* a, int) { return (long long)memcpy((void*)a[0], (const void*)a[1], (size_t)a[2]); } },
+	{ "strlen", [](long long* a, int) { return (long long)strlen((const char*)a[0]); } },
+	{ "puts", [](long long* a, int) { return (long long)puts((const char*)a[0]); } },
+	{ "putchar", [](long long* a, int) { return (long long)putchar((int)a[0]); } },
+	// every argument is passed as a 64 bit integer, which is how the formats %ld, %s and %p read them.
+	// the ones the call doesn't pass are 0
+	{ "printf", [](long long* a, int count) {
+		for (int i = count; i < MAX_HOST_ARGS; i++) a[i] = 0;
+		return (long long)printf((const char*)a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+	} },
+	{ "abs", [](long long* a, int) { return (long long)abs((int)a[0]); } },
+	{ "labs", [](long long* a, int) { return (long long)llabs(a[0]); } },
+	{ "exit", [](long long* a, int) { fflush(stdout); exit((int)a[0]); return 0ll; } },
+};
+
+int find_host_function(const std::string& name) {
+	for (size_t i = 0; i < sizeof(host_functions) / sizeof(host_functions[0]); i++) {
+		if (name == host_functions[i].name) return (int)i;
+	}
+	return -1;
+}
+
+const size_t STACK_REGISTERS = 1 << 20;
+
+// register i of the current call. registers go down in memory from r, like native stack
+// variables, so a variable declared after another sits just below it
+#define R(i) r[-(ptrdiff_t)(i)]
+
+struct call_frame {
+	const BytecodeInstr* return_to;
+	long long* registers;
+};
+
+// GCC and Clang can jump straight from one instruction's handler to the next through a table
+// of label addresses, which predicts better than returning to a single switch
+#if defined(__GNUC__)
+#define COMPUTED_GOTO
+#endif
+
+long long run_bytecode(const bytecode_program& program, int function) {
+	// left uninitialized, so only the pages a program reaches are ever touched. lowering
+	// writes every register before reading it
+	std::unique_ptr<long long[]> stack(new long long[STACK_REGISTERS]);
+	std::vector<call_frame> calls;
+	long long* const stack_end = stack.get() + STACK_REGISTERS;
+	long long host_args[MAX_HOST_ARGS];
+	const BytecodeInstr* const code = program.code.data();
+	const bytecode_function* const functions = program.functions.data();
+
+	long long* r = stack_end - 1;
+	const BytecodeInstr* pc = code + functions[function].start;
+	if (functions[function].registers > STACK_REGISTERS) throw std::exception("Bytecode stack overflow");
+
+	long long result = 0;
+	long long* args;
+	const bytecode_function* callee;
+	long long value;
+
+#ifdef COMPUTED_GOTO
+#define BYTECODE_LABEL(name) &&op_##name,
+	static void* const dispatch[] = { BYTECODE_OPS(BYTECODE_LABEL) };
+#define CASE(name) op_##name:
+#define NEXT() goto *dispatch[(int)(++pc)->op]
+#define DISPATCH() goto *dispatch[(int)pc->op]
+	DISPATCH();
+#else
+#define CASE(name) case BytecodeOp::name:
+#define NEXT() ++pc; continue
+#define DISPATCH() continue
+	for (;;) switch (pc->op) {
+#endif
+	CASE(Mov) R(pc->a) = R(pc->b); NEXT();
+	CASE(LoadI) R(pc->a) = pc->wide(); NEXT();
+	CASE(LoadK) R(pc->a) = program.constants[pc->wide()]; NEXT();
+	CASE(String) {
+		const std::string& s = program.strings[pc->wide()];
+		char* copy = (char*)malloc(s.size() + 1);
+		memcpy(copy, s.c_str(), s.size() + 1);
+		R(pc->a) = (long long)copy;
+		NEXT();
+	}
+	CASE(LocalAddr) R(pc->a) = (long long)&R(pc->b); NEXT();
+	// arithmetic that can overflow goes through unsigned, which wraps the way the machine does
+	CASE(Add) R(pc->a) = (long long)((unsigned long long)R(pc->b) + (unsigned long long)R(pc->c)); NEXT();
+	CASE(Sub) R(pc->a) = (long long)((unsigned long long)R(pc->b) - (unsigned long long)R(pc->c)); NEXT();
+	CASE(Mul) R(pc->a) = (long long)((unsigned long long)R(pc->b) * (unsigned long long)R(pc->c)); NEXT();
+	CASE(Div) R(pc->a) = R(pc->b) / R(pc->c); NEXT();
+	CASE(Mod) R(pc->a) = R(pc->b) % R(pc->c); NEXT();
+	CASE(And) R(pc->a) = R(pc->b) & R(pc->c); NEXT();
+	CASE(Or) R(pc->a) = R(pc->b) | R(pc->c); NEXT();
+	CASE(Xor) R(pc->a) = R(pc->b) ^ R(pc->c); NEXT();
+	CASE(Shl) R(pc->a) = (long long)((unsigned long long)R(pc->b) << (R(pc->c) & 63)); NEXT();
+	CASE(Shr) R(pc->a) = R(pc->b) >> (R(pc->c) & 63); NEXT();
+	CASE(AddI) R(pc->a) = (long long)((unsigned long long)R(pc->b) + (unsigned long long)(short)pc->c); NEXT();
+	CASE(MulI) R(pc->a) = (long long)((unsigned long long)R(pc->b) * (unsigned long long)(short)pc->c); NEXT();
+	CASE(Neg) R(pc->a) = (long long)(0 - (unsigned long long)R(pc->b)); NEXT();
+	CASE(Not) R(pc->a) = ~R(pc->b); NEXT();
+	CASE(LNot) R(pc->a) = !R(pc->b); NEXT();
+	CASE(Eq) R(pc->a) = R(pc->b) == R(pc->c); NEXT();
+	CASE(Ne) R(pc->a) = R(pc->b) != R(pc->c); NEXT();
+	CASE(Lt) R(pc->a) = R(pc->b) < R(pc->c); NEXT();
+	CASE(Gt) R(pc->a) = R(pc->b) > R(pc->c); NEXT();
+	CASE(Le) R(pc->a) = R(pc->b) <= R(pc->c); NEXT();
+	CASE(Ge) R(pc->a) = R(pc->b) >= R(pc->c); NEXT();
+	CASE(Sext8) R(pc->a) = (signed char)R(pc->b); NEXT();
+	CASE(Sext16) R(pc->a) = (short)R(pc->b); NEXT();
+	CASE(Sext32) R(pc->a) = (int)R(pc->b); NEXT();
+	CASE(Load8) R(pc->a) = *(signed char*)R(pc->b); NEXT();
+	CASE(Load16) R(pc->a) = *(short*)R(pc->b); NEXT();
+	CASE(Load32) R(pc->a) = *(int*)R(pc->b); NEXT();
+	CASE(Load64) R(pc->a) = *(long long*)R(pc->b); NEXT();
+	CASE(Store8) *(signed char*)R(pc->a) = (signed char)R(pc->b); NEXT();
+	CASE(Store16) *(short*)R(pc->a) = (short)R(pc->b); NEXT();
+	CASE(Store32) *(int*)R(pc->a) = (int)R(pc->b); NEXT();
+	CASE(Store64) *(long long*)R(pc->a) = R(pc->b); NEXT();
+	CASE(Jmp) pc = code + pc->wide(); DISPATCH();
+	CASE(Jz) if (R(pc->a) == 0) { pc = code + pc->wide(); DISPATCH(); } NEXT();
+	CASE(Jnz) if (R(pc->a) != 0) { pc = code + pc->wide(); DISPATCH(); } NEXT();
+	CASE(Call) {
+		callee = functions + pc->wide();
+	call:
+		args = &R(pc->a);
+		if (args - callee->registers < stack.get()) throw std::exception("Bytecode stack overflow");
+		calls.push_back({ pc + 1, r });
+		r = args;
+		pc = code + callee->start;
+		DISPATCH();
+	}
+	CASE(CallHost) {
+		value = pc->b;
+	call_host:
+		if (pc->c > MAX_HOST_ARGS) throw std::exception("Too many arguments to a host function");
+		for (int i = 0; i < pc->c; i++) host_args[i] = R(pc->a + i);
+		R(pc->a) = host_functions[value].function(host_args, pc->c);
+		NEXT();
+	}
+	CASE(CallR) {
+		value = R(pc->b);
+		if (value > 0) {
+			callee = functions + (value - 1);
+			goto call;
+		}
+		if (value == 0) throw std::exception("Call through a null function value");
+		value = -1 - value;
+		goto call_host;
+	}
+	CASE(Ret) {
+		R(0) = R(pc->a);
+		if (calls.empty()) {
+			result = R(0);
+			goto done;
+		}
+		pc = calls.back().return_to;
+		r = calls.back().registers;
+		calls.pop_back();
+		DISPATCH();
+	}
+#ifndef COMPUTED_GOTO
+	}
+#endif
+done:
+	return result;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "intern.h"
+
+// a second backend that needs no assembler or linker: functions are lowered to bytecode
+// for a register machine and run by an interpreter in this process.
+// every call gets a window of 64 bit registers on the interpreter's stack, holding the
+// parameters first, then local variables, then temporaries. a call passes its arguments
+// in consecutive registers of the caller, which become the first registers of the callee,
+// and the result comes back in the first of them. the registers are ordinary memory, so
+// taking the address of a local variable gives a pointer the program can use like any other.
+// they are laid out downwards like native stack variables, so register 1 is just below 0
+
+// a = b op c unless noted. "wide" is b and c read together as one 32 bit value
+#define BYTECODE_OPS(X) \
+	X(Mov)       /* a = b */ \
+	X(LoadI)     /* a = wide */ \
+	X(LoadK)     /* a = constants[wide] */ \
+	X(String)    /* a = a new copy of strings[wide] */ \
+	X(LocalAddr) /* a = the address of register b */ \
+	X(Add) X(Sub) X(Mul) X(Div) X(Mod) X(And) X(Or) X(Xor) X(Shl) X(Shr) \
+	X(AddI)      /* a = b + c as a signed 16 bit value */ \
+	X(MulI)      /* a = b * c as a signed 16 bit value */ \
+	X(Neg) X(Not) X(LNot) /* a = op b */ \
+	X(Eq) X(Ne) X(Lt) X(Gt) X(Le) X(Ge) \
+	X(Sext8) X(Sext16) X(Sext32) /* a = b sign extended from the low bits */ \
+	X(Load8) X(Load16) X(Load32) X(Load64)     /* a = the value at the address in b, sign extended */ \
+	X(Store8) X(Store16) X(Store32) X(Store64) /* the value at the address in a = b */ \
+	X(Jmp)       /* continue at instruction wide */ \
+	X(Jz) X(Jnz) /* continue at instruction wide if a is zero or isn't */ \
+	X(Call)      /* call functions[wide] with its arguments from register a */ \
+	X(CallHost)  /* call host function b with c arguments from register a */ \
+	X(CallR)     /* call the function value in register b with c arguments from register a */ \
+	X(Ret)       /* return a */
+
+#define BYTECODE_ENUM(name) name,
+
+enum class BytecodeOp : unsigned char {
+	BYTECODE_OPS(BYTECODE_ENUM)
+};
+
+struct BytecodeInstr {
+	BytecodeOp op;
+	unsigned short a, b, c;
+
+	int wide() const {
+		return (int)((unsigned int)c << 16 | b);
+	}
+};
+
+// a function value is the index of a bytecode function plus one, or minus one minus the
+// index of a host function, so zero is never a function
+inline long long bytecode_function_value(int function) {
+	return function + 1;
+}
+
+inline long long host_function_value(int function) {
+	return -1 - (long long)function;
+}
+
+struct bytecode_function {
+	symbol name;
+	unsigned int start = 0; // first instruction
+	unsigned short params = 0;
+	unsigned short registers = 0;
+};
+
+struct bytecode_program {
+	std::vector<BytecodeInstr> code;
+	std::vector<long long> constants;
+	std::vector<std::string> strings;
+	std::vector<bytecode_function> functions;
+
+	// -1 if there's no function called name
+	int find_function(symbol name) const;
+};
+
+// functions of the C runtime that bytecode can call. -1 if there's none called name
+int find_host_function(const std::string& name);
+
+// runs functions[function], which must take no parameters, and returns its result
+long long run_bytecode(const bytecode_program& program, int function);